@@ -0,0 +1,259 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "ip.h"
+#include "http.h"
+
+
+#if !defined(__cpp_impl_coroutine)
+    #error "<net/async.h> requires C++20 coroutines"
+#endif
+
+
+namespace net {
+
+
+    /*==========================================================================
+    net::task<T>
+
+    A lazily started coroutine producing a T.  A task runs when it is first
+    awaited and resumes its awaiter when it completes; exceptions propagate
+    to the awaiter.
+
+    e.g. task<size_t> count(ip::socket& s) { ... co_return n; }
+    --------------------------------------------------------------------------*/
+    template<typename T = void>
+    class task;
+
+
+    struct task_promise_base {
+
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+        std::exception_ptr      exception;
+
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+
+            template<typename Promise>
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<Promise> h) noexcept {
+                return h.promise().continuation;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        final_awaiter final_suspend() noexcept { return {}; }
+
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+
+    template<typename T>
+    struct task_promise : task_promise_base {
+
+        std::optional<T> value;
+
+        task<T> get_return_object();
+
+        template<typename U>
+        void return_value(U&& u) { value.emplace(std::forward<U>(u)); }
+
+        T result() {
+            if (exception) std::rethrow_exception(exception);
+            return std::move(*value);
+        }
+    };
+
+
+    template<>
+    struct task_promise<void> : task_promise_base {
+
+        task<void> get_return_object();
+
+        void return_void() {}
+
+        void result() {
+            if (exception) std::rethrow_exception(exception);
+        }
+    };
+
+
+    template<typename T>
+    class task {
+
+    public: // types
+
+        using promise_type = task_promise<T>;
+        using handle       = std::coroutine_handle<promise_type>;
+
+    private:
+
+        handle _handle;
+
+    public: // structors
+
+        task() = default;
+
+        explicit
+        task(handle h) : _handle(h) {}
+
+        task(task&& rv) : _handle(std::exchange(rv._handle, nullptr)) {}
+
+        task& operator=(task&& rv) { return assign(this, std::move(rv)); }
+
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+
+       ~task() { if (_handle) _handle.destroy(); }
+
+    public: // operators
+
+        explicit operator bool() const { return bool(_handle); }
+
+    public: // awaitable
+
+        bool await_ready() const { return not _handle or _handle.done(); }
+
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<> awaiter) {
+            _handle.promise().continuation = awaiter;
+            return _handle;
+        }
+
+        T await_resume() { return _handle.promise().result(); }
+
+    };
+
+
+    template<typename T> inline
+    task<T>
+    task_promise<T>::get_return_object() {
+        return task<T>(task<T>::handle::from_promise(*this));
+    }
+
+
+    inline
+    task<void>
+    task_promise<void>::get_return_object() {
+        return task<void>(task<void>::handle::from_promise(*this));
+    }
+
+
+    //--------------------------------------------------------------------------
+
+
+    struct detached {
+        struct promise_type {
+            detached get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+
+    /*==========================================================================
+    spawn(task)
+
+    Starts a task without awaiting it; the task owns itself until it
+    completes.  An exception escaping the task terminates the program.
+    --------------------------------------------------------------------------*/
+    template<typename T>
+    detached
+    spawn(task<T> t) { co_await std::move(t); }
+
+
+    /*==========================================================================
+    T sync_wait(task<T>, reactor&)
+
+    Starts a task and drives the reactor on the calling thread until the task
+    has completed, returning its result.
+    --------------------------------------------------------------------------*/
+    template<typename T>
+    T
+    sync_wait(task<T> t, ip::reactor& reactor = ip::reactor::shared()) {
+        // awaits the task's completion, leaving its result to be taken once
+        struct completion {
+            task<T>& t;
+            bool await_ready() const { return t.await_ready(); }
+            auto await_suspend(std::coroutine_handle<> h) {
+                return t.await_suspend(h);
+            }
+            void await_resume() {}
+        };
+        std::atomic<bool> done { false };
+        std::optional<task<T>> finished;
+        [](task<T> t, std::atomic<bool>& done, std::optional<task<T>>& out)
+        -> detached {
+            co_await completion { t };
+            out.emplace(std::move(t));
+            done = true;
+        }(std::move(t), done, finished);
+        while (not done) { reactor.poll(10); }
+        return finished->await_resume();
+    }
+
+
+namespace http {
+
+
+    /*==========================================================================
+    task<response> async_send(...)
+
+    Sends a request and receives its response without blocking a thread while
+    connecting, sending or receiving.  Host name resolution is synchronous, so
+    resolve once and pass the ip::address when issuing many requests.
+    --------------------------------------------------------------------------*/
+    inline
+    task<response>
+    async_send(
+        ip::address   address,
+        http::string  message,
+        ip::reactor&  reactor = ip::reactor::shared()
+    ) {
+        if (not address.ok()) co_return response();
+
+        ip::socket socket;
+        if (auto err = co_await socket.async_connect(address, reactor)) {
+            co_return response();
+        }
+
+        ip::transfer tx = co_await socket.async_sendall(message, reactor);
+        if (tx.error) co_return response();
+
+        response response; string response_buffer;
+
+        char block[4096];
+        const ip::target target(block, ip::NO_FILL);
+        while ((tx = co_await socket.async_recv(target, reactor)) and tx.size) {
+            response_buffer.append(block, tx.size);
+            if (response.read(response_buffer)) {
+                co_return response;
+            }
+        }
+        co_return http::response();
+    }
+
+
+    inline
+    task<response>
+    async_send(
+        const request& request,
+        ip::reactor&   reactor = ip::reactor::shared()
+    ) {
+        const ip::address address(ip::TCP, request.uri.c_str());
+        return async_send(address, request.write(), reactor);
+    }
+
+
+} // namespace http
+
+
+} // namespace net
@@ -1,8 +1,22 @@
 #pragma once
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include "ip.h"
 
 
@@ -13,8 +27,20 @@ namespace net {
 namespace http {
 
 
-    using string = std::string;
-    using socket = net::ip::socket;
+    // Built with NET_HTTP_PMR=1, strings and maps are std::pmr, so the server
+    // allocates each exchange from a per-connection arena; by default they
+    // are the standard ones.
+#if NET_HTTP_PMR
+    using string    = std::pmr::string;
+    using allocator = std::pmr::polymorphic_allocator<char>;
+    using multimap  = std::pmr::multimap<string, string, std::less<>>;
+#else
+    using string    = std::string;
+    using allocator = std::allocator<char>;
+    using multimap  = std::multimap<string, string, std::less<>>;
+#endif
+    using socket    = net::ip::socket;
+    using arena     = std::pmr::monotonic_buffer_resource;
 
 
     //--------------------------------------------------------------------------
@@ -42,9 +68,8 @@ namespace http {
     string_to_method(const char*);
 
 
-    inline
     http::method
-    string_to_method(const string& s) { return string_to_method(s.c_str()); }
+    string_to_method(std::string_view);
 
 
     //--------------------------------------------------------------------------
@@ -116,93 +141,145 @@ namespace http {
     string_to_status(const char*);
 
 
-    inline
     http::status
-    string_to_status(const string& s) { return string_to_status(s.c_str()); }
+    string_to_status(std::string_view);
 
 
     //--------------------------------------------------------------------------
 
 
-    template<typename T>
-    T
-    string_to(const string&);
+    // well-known headers, stored by id in http::headers
+    enum header : uint8_t {
+        HEADER_UNKNOWN,
+
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_RANGES,
+        AUTHORIZATION,
+        CACHE_CONTROL,
+        CONNECTION,
+        CONTENT_ENCODING,
+        CONTENT_LENGTH,
+        CONTENT_RANGE,
+        CONTENT_TYPE,
+        COOKIE,
+        DATE,
+        ETAG,
+        EXPECT,
+        HOST,
+        IF_MODIFIED_SINCE,
+        IF_NONE_MATCH,
+        IF_RANGE,
+        LAST_MODIFIED,
+        LOCATION,
+        RANGE,
+        SEC_WEBSOCKET_ACCEPT,
+        SEC_WEBSOCKET_KEY,
+        SEC_WEBSOCKET_VERSION,
+        SERVER,
+        SET_COOKIE,
+        TRANSFER_ENCODING,
+        UPGRADE,
+        USER_AGENT,
+
+        HEADER_COUNT
+    };
 
 
-    template<> inline
-    int
-    string_to<int>(const string& s) {
-        return int(std::strtol(s.c_str(),nullptr,0));
-    }
+    // the canonical name, e.g. "Content-Length"
+    const char*
+    header_to_string(http::header);
 
 
-    template<> inline
-    long
-    string_to<long>(const string& s) {
-        return std::strtol(s.c_str(),nullptr,0);
-    }
+    // recognizes a well-known name whatever its case
+    http::header
+    string_to_header(std::string_view);
 
 
-    template<> inline
-    long long
-    string_to<long long>(const string& s) {
-        return std::strtoll(s.c_str(),nullptr,0);
-    }
+    // compares ASCII strings ignoring case, eight bytes at a time
+    bool
+    iequals(std::string_view, std::string_view);
 
 
-    template<> inline
-    unsigned
-    string_to<unsigned>(const string& s) {
-        return unsigned(std::strtoul(s.c_str(),nullptr,0));
-    }
+    //--------------------------------------------------------------------------
 
 
-    template<> inline
-    unsigned long
-    string_to<unsigned long>(const string& s) {
-        return std::strtoul(s.c_str(),nullptr,0);
-    }
+    /*==========================================================================
+    bool string_to(std::string_view s, T& value)
 
+    Parses all of `s` as a decimal number, method or status.  Returns false,
+    leaving `value` unchanged, if `s` is empty, has any unparsed characters or
+    does not fit in a T.
 
-    template<> inline
-    unsigned long long
-    string_to<unsigned long long>(const string& s) {
-        return std::strtoull(s.c_str(),nullptr,0);
-    }
-
+    T string_to<T>(std::string_view s)
 
-    template<> inline
-    float
-    string_to<float>(const string& s) {
-        return std::strtof(s.c_str(),nullptr);
-    }
-
-
-    template<> inline
-    double
-    string_to<double>(const string& s) {
-        return std::strtod(s.c_str(),nullptr);
+    As above, returning T{} when `s` cannot be parsed.
+    --------------------------------------------------------------------------*/
+    template<typename T>
+    std::enable_if_t<
+        std::is_arithmetic<T>::value and not std::is_same<T, bool>::value,
+        bool>
+    string_to(std::string_view s, T& value) {
+        const char* const first = s.data();
+        const char* const last  = first + s.size();
+        T parsed {};
+    #if !defined(__cpp_lib_to_chars)
+        if constexpr (std::is_floating_point<T>::value) {
+            // no floating point from_chars; strto* needs a terminated copy
+            char buffer[64];
+            if (s.empty() or s.size() >= sizeof(buffer)) return false;
+            if (std::isspace((unsigned char)s[0]) or s[0] == '+') return false;
+            memcpy(buffer, first, s.size());
+            buffer[s.size()] = '\0';
+            char* end = nullptr;
+            errno = 0;
+            if constexpr (std::is_same<T, float>::value)
+                parsed = std::strtof(buffer, &end);
+            else if constexpr (std::is_same<T, double>::value)
+                parsed = std::strtod(buffer, &end);
+            else
+                parsed = std::strtold(buffer, &end);
+            if (end != buffer + s.size() or errno == ERANGE) return false;
+            value = parsed;
+            return true;
+        }
+        else
+    #endif
+        {
+            const auto result = std::from_chars(first, last, parsed);
+            if (result.ec != std::errc() or result.ptr != last) return false;
+            value = parsed;
+            return true;
+        }
     }
 
 
-    template<> inline
-    long double
-    string_to<long double>(const string& s) {
-        return std::strtold(s.c_str(),nullptr);
+    inline
+    bool
+    string_to(std::string_view s, http::method& value) {
+        const http::method parsed = string_to_method(s);
+        if (not parsed) return false;
+        value = parsed;
+        return true;
     }
 
 
-    template<> inline
-    http::method
-    string_to<http::method>(const string& s) {
-        return string_to_method(s);
+    inline
+    bool
+    string_to(std::string_view s, http::status& value) {
+        const http::status parsed = string_to_status(s);
+        if (not parsed) return false;
+        value = parsed;
+        return true;
     }
 
 
-    template<> inline
-    http::status
-    string_to<http::status>(const string& s) {
-        return string_to_status(s);
+    template<typename T>
+    T
+    string_to(std::string_view s) {
+        T value {};
+        string_to(s, value);
+        return value;
     }
 
 
@@ -211,7 +288,10 @@ namespace http {
 
     template<typename T>
     string
-    to_string(T&& t) { return std::to_string(t); }
+    to_string(T&& t) {
+        const std::string s = std::to_string(t);
+        return string(s.data(), s.size());
+    }
 
 
     inline
@@ -227,8 +307,15 @@ namespace http {
     //--------------------------------------------------------------------------
 
 
-    class pairs : std::map<string, string> {
-        using map = std::map<string, string>;
+    /*==========================================================================
+    net::http::pairs
+
+    Ordered key/value pairs which may repeat a key, as headers and query
+    strings do.  set() replaces every value of a key, add() appends another;
+    lookups return the first value added.
+    --------------------------------------------------------------------------*/
+    class pairs : http::multimap {
+        using map = http::multimap;
 
     public: // structors
 
@@ -236,8 +323,6 @@ namespace http {
 
     public: // operators
 
-        using map::operator[];
-
         string operator[](const string& key) const { return get(key); }
 
     public: // properties
@@ -250,30 +335,50 @@ namespace http {
     public: // methods
 
         using map::clear;
+        using map::equal_range;
 
-        bool has(const string& key) const {
-            auto itr = map::find(key);
-            return (itr != map::end());
+        bool has(std::string_view key) const {
+            return first(key) != map::end();
         }
 
-        string get(const string& key) const {
-            auto itr = map::find(key);
+        string get(std::string_view key) const {
+            auto itr = first(key);
             return (itr != map::end()) ? itr->second : string{""};
         }
 
+        // returns `fallback` if `key` is missing or its value does not parse
         template<typename T>
-        T get(const string& key, T fallback = {}) const {
-            auto itr = map::find(key);
-            return (itr != map::end()) ? string_to<T>(itr->second) : fallback;
+        T get(std::string_view key, T fallback = {}) const {
+            auto itr = first(key);
+            T value;
+            if (itr != map::end() and string_to(itr->second, value)) {
+                return value;
+            }
+            return fallback;
         }
 
-        void set(const string& key, string value) {
-            map::operator[](key) = value;
+        // allocates only from this container's allocator
+        void set(std::string_view key, std::string_view value) {
+            auto range = map::equal_range(key);
+            if (range.first != range.second) {
+                range.first->second = value;
+                map::erase(std::next(range.first), range.second);
+            }
+            else {
+                map::emplace(key, value);
+            }
         }
 
-        template<typename T>
-        void set(const string& key, T value) {
-            set(key, to_string(value));
+        template<
+            typename T,
+            typename = std::enable_if_t<
+                not std::is_convertible<T, std::string_view>::value>>
+        void set(std::string_view key, T value) {
+            set(key, std::string_view(to_string(value)));
+        }
+
+        void add(std::string_view key, std::string_view value) {
+            map::emplace(key, value);
         }
 
     public: // iterators
@@ -281,30 +386,417 @@ namespace http {
         map::const_iterator begin() const { return map::cbegin(); }
         map::const_iterator   end() const { return map::cend(); }
 
+    private:
+
+        map::const_iterator first(std::string_view key) const {
+            auto itr = map::lower_bound(key);
+            return (itr != map::end() and itr->first == key) ? itr : map::end();
+        }
+
+    };
+
+
+    /*==========================================================================
+    net::http::headers
+
+    Header fields, as pairs ordered by name.  Well-known names are recognized
+    once, as they are stored, and kept in their canonical case, so looking
+    one up by name in any case, or by its http::header id without copying,
+    finds its first value in constant time; other names are looked up as
+    given.
+    --------------------------------------------------------------------------*/
+    class headers {
+        using map = http::multimap;
+
+        map           fields;
+        const string* known[HEADER_COUNT] = {}; // first value of each
+
+    public: // types
+
+        using allocator_type = http::allocator;
+
+    public: // structors
+
+        headers() = default;
+
+        explicit
+        headers(allocator_type alloc) : fields(alloc) {}
+
+        headers(
+            std::initializer_list<
+                std::pair<std::string_view, std::string_view>> list) {
+            for (auto& pair : list) add(pair.first, pair.second);
+        }
+
+        headers(const http::pairs& pairs) {
+            for (auto& pair : pairs) add(pair.first, pair.second);
+        }
+
+        headers(const headers& h) : fields(h.fields) { index(); }
+
+        headers(headers&& rv) : fields(std::move(rv.fields)) {
+            index();
+            rv.clear();
+        }
+
+        headers& operator=(const headers& h) {
+            fields = h.fields;
+            index();
+            return *this;
+        }
+
+        headers& operator=(headers&& rv) {
+            fields = std::move(rv.fields);
+            index();
+            rv.clear();
+            return *this;
+        }
+
+    public: // operators
+
+        string operator[](std::string_view key) const { return get(key); }
+
+    public: // properties
+
+        bool any() const { return not fields.empty(); }
+
+        bool   empty() const { return fields.empty(); }
+        size_t  size() const { return fields.size(); }
+
+    public: // methods
+
+        void clear() {
+            fields.clear();
+            for (auto& value : known) value = nullptr;
+        }
+
+        bool has(http::header id) const { return known[id] != nullptr; }
+
+        bool has(std::string_view key) const { return find(key) != nullptr; }
+
+        // the first value of a well-known header, or an empty view
+        std::string_view get(http::header id) const {
+            return known[id] ? std::string_view(*known[id]) : "";
+        }
+
+        string get(std::string_view key) const {
+            const string* const value = find(key);
+            return value ? *value : string{""};
+        }
+
+        // returns `fallback` if the header is missing or does not parse
+        template<typename T>
+        T get(http::header id, T fallback = {}) const {
+            T value;
+            return known[id] and string_to(*known[id], value)
+                ? value : fallback;
+        }
+
+        template<typename T>
+        T get(std::string_view key, T fallback = {}) const {
+            const string* const found = find(key);
+            T value;
+            return found and string_to(*found, value) ? value : fallback;
+        }
+
+        // set() replaces every value of a header, add() appends another
+        void set(http::header id, std::string_view value) {
+            store(id, {}, value, true);
+        }
+
+        void set(std::string_view key, std::string_view value) {
+            store(string_to_header(key), key, value, true);
+        }
+
+        template<
+            typename T,
+            typename = std::enable_if_t<
+                not std::is_convertible<T, std::string_view>::value>>
+        void set(std::string_view key, T value) {
+            set(key, std::string_view(to_string(value)));
+        }
+
+        void add(http::header id, std::string_view value) {
+            store(id, {}, value, false);
+        }
+
+        void add(std::string_view key, std::string_view value) {
+            store(string_to_header(key), key, value, false);
+        }
+
+        // removes every value of a header
+        void erase(http::header id) { erase(header_to_string(id)); }
+
+        void erase(std::string_view key);
+
+        auto equal_range(std::string_view key) const {
+            const http::header id = string_to_header(key);
+            return fields.equal_range(id ? header_to_string(id) : key);
+        }
+
+    public: // iterators
+
+        map::const_iterator begin() const { return fields.cbegin(); }
+        map::const_iterator   end() const { return fields.cend(); }
+
+    private:
+
+        const string* find(std::string_view key) const;
+
+        // `key` may be empty for a well-known `id`
+        void store(
+            http::header id, std::string_view key, std::string_view value,
+            bool replace);
+
+        void index();
     };
 
 
     //--------------------------------------------------------------------------
 
 
+    /*==========================================================================
+    string_view url_decode(string_view s, string& scratch)
+
+    Decodes %XX escapes and '+' in a query key or value.  Returns `s` itself
+    when it has nothing to decode, otherwise decodes into `scratch` and
+    returns a view of it.  Malformed escapes are kept as they are.
+    --------------------------------------------------------------------------*/
+    std::string_view
+    url_decode(std::string_view s, string& scratch);
+
+
+    void
+    url_encode(std::string_view s, string& buffer);
+
+
+    /*==========================================================================
+    net::http::query
+
+    A request's query string, kept as received and only split and decoded
+    into pairs when first looked up, so services that ignore it pay nothing.
+    Because lookups on a const query may do that work, one query must not be
+    read from several threads at once.
+
+    raw() iterates the received key/value pairs without decoding them, e.g.
+        for (auto pair : request.query.raw()) { pair.first, pair.second }
+    --------------------------------------------------------------------------*/
+    class query {
+
+        string              text;
+        mutable http::pairs decoded;
+        mutable bool        parsed = true;
+
+    public: // types
+
+        using allocator_type = http::allocator;
+
+        class view;
+
+    public: // structors
+
+        query() = default;
+
+        explicit
+        query(allocator_type alloc) : text(alloc), decoded(alloc) {}
+
+        query(http::pairs pairs) : decoded(std::move(pairs)) {}
+
+    public: // operators
+
+        string operator[](const string& key) const { return get(key); }
+
+    public: // properties
+
+        bool any() const { return not text.empty() or decoded.any(); }
+
+        // the undecoded query string, empty once modified
+        std::string_view str() const { return text; }
+
+        view raw() const;
+
+        const http::pairs& pairs() const { parse(); return decoded; }
+
+    public: // methods
+
+        void clear() { text.clear(); decoded.clear(); parsed = true; }
+
+        // takes the undecoded text after '?'
+        void read(std::string_view s) { clear(); text = s; parsed = s.empty(); }
+
+        void write(string& buffer) const;
+
+        bool has(std::string_view key) const { return pairs().has(key); }
+
+        string get(std::string_view key) const { return pairs().get(key); }
+
+        template<typename T>
+        T get(std::string_view key, T fallback = {}) const {
+            return pairs().get(key, fallback);
+        }
+
+        template<typename T>
+        void set(std::string_view key, T&& value) {
+            modify().set(key, std::forward<T>(value));
+        }
+
+        void add(std::string_view key, std::string_view value) {
+            modify().add(key, value);
+        }
+
+    public: // iterators
+
+        auto begin() const { return pairs().begin(); }
+        auto   end() const { return pairs().end(); }
+
+    private:
+
+        void parse() const;
+
+        http::pairs& modify() { parse(); text.clear(); return decoded; }
+
+    };
+
+
+    class query::view {
+
+        std::string_view s;
+
+    public:
+
+        using value_type = std::pair<std::string_view, std::string_view>;
+
+        class iterator {
+            std::string_view rest;
+            value_type       pair;
+
+            void next() {
+                while (not rest.empty()) {
+                    const size_t amp = rest.find('&');
+                    const std::string_view item = rest.substr(0, amp);
+                    rest = (amp == rest.npos)
+                         ? std::string_view()
+                         : rest.substr(amp + 1);
+                    const size_t eq = item.find('=');
+                    pair.first  = item.substr(0, eq);
+                    pair.second = (eq == item.npos)
+                                ? std::string_view()
+                                : item.substr(eq + 1);
+                    if (not pair.first.empty()) return;
+                }
+                // the end iterator, even after a trailing '&'
+                rest = std::string_view();
+                pair = {};
+            }
+
+        public:
+
+            iterator() = default;
+
+            explicit iterator(std::string_view s) : rest(s) { next(); }
+
+            const value_type& operator*() const { return pair; }
+            const value_type* operator->() const { return &pair; }
+
+            iterator& operator++() { next(); return *this; }
+
+            bool operator==(const iterator& i) const {
+                return rest.data() == i.rest.data()
+                    and pair.first.data() == i.pair.first.data();
+            }
+            bool operator!=(const iterator& i) const {
+                return not (*this == i);
+            }
+        };
+
+        explicit view(std::string_view s) : s(s) {}
+
+        iterator begin() const { return iterator(s); }
+        iterator   end() const { return iterator(); }
+    };
+
+
+    inline
+    query::view
+    query::raw() const { return view(text); }
+
+
+    //--------------------------------------------------------------------------
+
+
     struct response;
 
 
+    /*==========================================================================
+    net::http::hedging
+
+    An opt-in policy for request::send() of idempotent requests.  When the
+    first attempt is unanswered after the `percentile` latency of recent
+    calls, the request is also sent to the host's next resolved address; the
+    first response wins and the other connection is closed.  Share one policy
+    between the calls it should learn from, from any number of threads.
+    --------------------------------------------------------------------------*/
+    class hedging {
+    public: // settings
+
+        double percentile   = 0.95;
+        int    min_delay_ms = 1;
+        int    max_delay_ms = 1000; // also used until enough calls are seen
+        int    timeout_ms   = -1;   // per call, negative waits indefinitely
+
+    public: // counters, for tuning
+
+        std::atomic<uint64_t> calls  { 0 };
+        std::atomic<uint64_t> hedges { 0 }; // calls that sent a second request
+        std::atomic<uint64_t> wins   { 0 }; // ... which answered first
+
+    public: // methods
+
+        // the current hedging delay, from the latencies recorded so far
+        int delay_ms() const;
+
+        void record(int latency_us);
+
+    private:
+
+        enum { SAMPLES = 256, MIN_SAMPLES = 16 };
+
+        mutable std::mutex mutex;
+        int                samples[SAMPLES] = {};
+        size_t             recorded = 0;
+    };
+
+
     struct request {
-        http::method method = METHOD_UNKNOWN;
-        http::string uri;
-        http::pairs  query;
-        http::pairs  headers;
-        http::string content;
+        http::method  method = METHOD_UNKNOWN;
+        http::string  uri;
+        http::query   query;
+        http::headers headers;
+        http::string  content;
+
+    public: // types
+
+        using allocator_type = http::allocator;
 
     public: // structors
 
+        explicit
+        request(allocator_type alloc)
+        : uri    (alloc)
+        , query  (alloc)
+        , headers(alloc)
+        , content(alloc) {}
+
+        // allocates from `arena` with NET_HTTP_PMR, as usual otherwise
+        explicit
+        request(http::arena&);
+
         request(
-            http::method method  = METHOD_UNKNOWN,
-            http::string uri     = {},
-            http::pairs  query   = {},
-            http::pairs  headers = {},
-            http::string content = {}
+            http::method  method  = METHOD_UNKNOWN,
+            http::string  uri     = {},
+            http::query   query   = {},
+            http::headers headers = {},
+            http::string  content = {}
         )
         : method (method)
         , uri    (uri)
@@ -335,6 +827,17 @@ namespace http {
 
         void reset();
 
+        // starts over on `arena`, leaving what was allocated from it to be
+        // released with the arena, all at once
+        void reset(http::arena&);
+
+        // parses one message from the front of `buffer`, returning its
+        // length, or 0 until `buffer` holds a complete message; a head whose
+        // Content-Length is malformed, negative or too large is consumed
+        // alone and leaves the request reset, not ok(), to be refused
+        size_t parse(std::string_view buffer);
+
+        // parses and erases one message from the front of `buffer`
         bool read(string& buffer);
 
         void write(string& buffer) const;
@@ -343,6 +846,11 @@ namespace http {
 
         response send() const;
 
+        response send(http::hedging&) const;
+
+        // over a local socket, which is not named in the uri
+        response send(const ip::path&) const;
+
     };
 
 
@@ -355,18 +863,93 @@ namespace http {
     std::ostream& operator<<(std::ostream&, const request&);
 
 
+    /*==========================================================================
+    net::http::file
+
+    An open file to send as a response body in place of `content`.  The
+    server sends it from the page cache, with sendfile(2) or by splicing it
+    on the IO_URING engine, so its bytes are never copied into the process.
+    Its ETag and Last-Modified are taken when it is opened.  A file may be
+    shared by any number of responses, and is closed with the last of them.
+
+    e.g. response.file = http::file::open("assets/video.mp4");
+    --------------------------------------------------------------------------*/
+    class file {
+    public:
+
+        const int         fd;
+        const uint64_t    size;
+        const std::string etag;          // "<size>-<mtime>", hex
+        const std::string last_modified; // IMF-fixdate
+
+    public: // structors
+
+        // returns null if `path` cannot be opened as a regular file
+        static std::shared_ptr<const file> open(const char* path);
+
+        file(const file&) = delete;
+        file& operator=(const file&) = delete;
+
+       ~file();
+
+    private:
+
+        file(int fd, uint64_t size, std::string etag, std::string modified)
+        : fd(fd), size(size), etag(etag), last_modified(modified) {}
+    };
+
+
+    using file_ptr = std::shared_ptr<const file>;
+
+
+    /*==========================================================================
+    parse_ranges(header, size, ranges)
+
+    Reads the byte ranges of a Range header ("bytes=0-99, 200-, -50") for a
+    body of `size` bytes into `ranges`, each clamped to the body and in the
+    order listed, leaving out ranges that start past its end.  Returns false
+    if the header is malformed or lists more than MAX_RANGES, and should then
+    be ignored; returns true with no ranges if none can be satisfied.
+    --------------------------------------------------------------------------*/
+    struct byte_range {
+        uint64_t first, last; // inclusive
+    };
+
+    enum { MAX_RANGES = 32 };
+
+    bool
+    parse_ranges(
+        std::string_view         header,
+        uint64_t                 size,
+        std::vector<byte_range>& ranges);
+
+
     //--------------------------------------------------------------------------
 
 
     struct response {
-        http::status status = STATUS_UNKNOWN;
-        http::pairs  headers;
-        http::string content;
+        http::status   status = STATUS_UNKNOWN;
+        http::headers  headers;
+        http::string   content;
+        http::file_ptr file; // sent instead of `content` when set
+
+    public: // types
+
+        using allocator_type = http::allocator;
 
     public: // structors
 
         response() = default;
 
+        explicit
+        response(allocator_type alloc)
+        : headers(alloc)
+        , content(alloc) {}
+
+        // allocates from `arena` with NET_HTTP_PMR, as usual otherwise
+        explicit
+        response(http::arena&);
+
         response(http::status status) : status(status) {}
 
         response(string s) { read(s); }
@@ -392,6 +975,21 @@ namespace http {
 
         void reset();
 
+        // starts over on `arena`, leaving what was allocated from it to be
+        // released with the arena, all at once
+        void reset(http::arena&);
+
+        // parses one message from the front of `buffer`, returning its
+        // length, or 0 until `buffer` holds a complete message; a head whose
+        // Content-Length is malformed, negative or too large is consumed
+        // alone and leaves the response reset, not ok(), to be refused
+        size_t parse(std::string_view buffer);
+
+        // as above, for a response to a `method` request: one to HEAD, and
+        // one with status 1xx, 204 or 304, has no body
+        size_t parse(std::string_view buffer, http::method);
+
+        // parses and erases one message from the front of `buffer`
         bool read(string& buffer);
 
         void write(string& buffer) const;
@@ -420,12 +1018,664 @@ namespace http {
     response getText(string uri, pairs query = {});
 
 
+    /*==========================================================================
+    send_many(requests, count, timeout_ms, on_response)
+
+    Sends a batch of requests concurrently from the calling thread over
+    non-blocking sockets.  Each host is resolved once and its requests are
+    pipelined over one connection, which is reopened once if the server
+    closes it early; only idempotent requests are resent, and the others fail
+    with the connection's error.  `on_response(index, response, error)` is
+    called for each request as its response arrives.  Requests still
+    unanswered when `timeout_ms` expires, or whose host fails, are completed
+    with an error and an empty response.  A negative timeout waits
+    indefinitely.
+
+    get_many(uris, timeout_ms, on_response) sends a GET to each uri.
+    --------------------------------------------------------------------------*/
+    using completion = std::function<void(size_t, response&, ip::error)>;
+
+    void send_many(
+        const request*    requests,
+        size_t            count,
+        int               timeout_ms,
+        const completion& on_response);
+
+    void send_many(
+        const std::vector<request>& requests,
+        int                         timeout_ms,
+        const completion&           on_response);
+
+    void get_many(
+        const std::vector<string>& uris,
+        int                        timeout_ms,
+        const completion&          on_response);
+
+
     //--------------------------------------------------------------------------
 
 
     using service = std::function<void(const request&, response&)>;
 
 
+    /*==========================================================================
+    net::http::proxy
+
+    A service forwarding each request to one of a pool of upstream servers,
+    over connections kept open between requests.  Hop-by-hop headers are
+    dropped in both directions, and a Via header added.  A request's body is
+    sent as received and the response's body is read straight into its
+    content, up to the upstream closing the connection if the response has
+    no Content-Length.  Chunked responses, and those over `max_content`
+    bytes, get a 502.
+
+    forward() blocks until the upstream answers, for up to `timeout_ms` per
+    step, so serve the proxy with the THREADED engine: the io_uring engine
+    calls services on its event loops, where one slow upstream would stall
+    every connection on the loop.
+
+    An upstream that fails is passed over until a health check, a GET of
+    `health_uri` every `health_interval_ms`, succeeds again; with checks off
+    it keeps being tried.  A request no upstream answers gets a 502.
+
+    e.g. http::proxy  proxy({ "10.0.0.1:8080", "10.0.0.2:8080" });
+         http::server server(proxy.service());
+         server.start(8000, http::THREADED);
+    --------------------------------------------------------------------------*/
+    class proxy {
+    public: // types
+
+        enum balancing {
+            ROUND_ROBIN,       // each upstream in turn
+            LEAST_OUTSTANDING, // the one with the fewest requests in flight
+            CONSISTENT_HASH,   // by key, so a key keeps its upstream
+        };
+
+    public: // settings, before the first request
+
+        balancing   balance  = ROUND_ROBIN;
+        std::string hash_key;              // a header, or empty for the uri
+        std::string health_uri = "/";
+        int         health_interval_ms = 1000; // 0 leaves checks off
+        int         timeout_ms = 30000;    // per connect, send or receive
+        size_t      max_idle   = 16;       // open connections per upstream
+        size_t      max_content = 64 << 20; // response body bytes
+
+    public: // counters
+
+        std::atomic<uint64_t> forwarded { 0 };
+        std::atomic<uint64_t> failed    { 0 }; // answered with a 502
+
+    public: // structors
+
+        // upstreams are "host:port", resolved once
+        explicit
+        proxy(const std::vector<std::string>& upstreams);
+
+       ~proxy();
+
+        proxy(const proxy&) = delete;
+        proxy& operator=(const proxy&) = delete;
+
+    public: // properties
+
+        size_t size() const { return upstreams.size(); }
+
+        bool healthy(size_t upstream) const;
+
+    public: // methods
+
+        // forwards to this proxy, which must outlive the service
+        http::service service() {
+            return [this](const request& q, response& r) { forward(q, r); };
+        }
+
+        void forward(const request&, response&);
+
+    private:
+
+        struct upstream;
+
+        std::vector<std::unique_ptr<upstream>>    upstreams;
+        std::vector<std::pair<uint64_t, size_t>>  ring; // hash, upstream
+        std::atomic<size_t>                       turn { 0 };
+
+        std::once_flag          started;
+        std::mutex              checker_mutex;
+        std::condition_variable checker_wake;
+        bool                    stopping = false;
+        std::thread             checker;
+
+        upstream* pick(const request&);
+        void      check(); // the health checking thread
+    };
+
+
+    /*==========================================================================
+    net::http::websocket
+
+    A WebSocket (RFC 6455) connection, taken over from the server after an
+    upgrade handshake.  The connection's server thread passes each received
+    message to on_message(), reassembling fragmented messages and answering
+    pings, and writes whatever send() could not write at once.
+
+    send() may be called from any thread and never blocks: a frame is written
+    at once when nothing is queued ahead of it, and is queued otherwise.  Once
+    more than `high_water` bytes are queued, send() refuses with EWOULDBLOCK
+    until the queue has drained to half of that, when on_drain() is called.
+    A ping that arrives with more than `high_water` bytes queued closes the
+    connection with 1008, as its peer is not reading the pongs.
+    --------------------------------------------------------------------------*/
+    class websocket {
+
+        using lock = std::lock_guard<std::mutex>;
+
+    public: // types
+
+        enum opcode : uint8_t {
+            CONTINUATION = 0x0,
+            TEXT         = 0x1,
+            BINARY       = 0x2,
+            CLOSE        = 0x8,
+            PING         = 0x9,
+            PONG         = 0xA,
+        };
+
+        struct frame {
+            bool     fin     = false;
+            uint8_t  rsv     = 0;     // reserved bits, must be 0
+            opcode   type    = CONTINUATION;
+            bool     masked  = false;
+            uint8_t  mask[4] = {};
+            uint64_t size    = 0;     // payload bytes
+        };
+
+    public: // callbacks, invoked on the connection's server thread
+
+        std::function<void(websocket&, opcode, std::string_view)> on_message;
+        std::function<void(websocket&)>                           on_drain;
+        std::function<void(websocket&, uint16_t code)>            on_close;
+
+    public: // limits
+
+        size_t high_water  = 1 << 20;  // queued bytes before send() refuses
+        size_t max_message = 16 << 20; // longer messages close with 1009
+
+    private:
+
+        mutable std::mutex mutex;
+        const ip::socket*  connection = nullptr; // while the server serves it
+        int                wakeup     = -1;
+        string             queue;               // frames not yet written
+        size_t             written    = 0;      // bytes of `queue` written
+        bool               closing    = false;  // a CLOSE has been queued
+        bool               finished   = false;  // the connection has ended
+        bool               blocked    = false;  // send() refused, drain due
+
+        // the server thread's reassembly state
+        string             message;
+        opcode             message_type = CONTINUATION;
+        uint16_t           close_code   = 1006; // closed without a CLOSE
+
+        friend class server;
+
+    public: // structors
+
+        websocket() = default;
+
+        websocket(const websocket&) = delete;
+        websocket& operator=(const websocket&) = delete;
+
+    public: // operators
+
+        explicit operator bool() const { return ok(); }
+
+    public: // properties
+
+        // connected, and not closing
+        bool ok() const;
+
+        // bytes waiting to be written
+        size_t queued() const;
+
+    public: // methods
+
+        ip::error send(std::string_view payload, opcode = TEXT);
+
+        ip::error ping(std::string_view payload = {});
+
+        // starts the closing handshake; later sends fail with ENOTCONN
+        ip::error close(uint16_t code = 1000, std::string_view reason = {});
+
+    public: // protocol
+
+        // the Sec-WebSocket-Accept value answering a Sec-WebSocket-Key
+        static string accept_key(std::string_view key);
+
+        // decodes the frame header at the front of `buffer`, returning its
+        // length, or 0 until `buffer` holds a complete header
+        static size_t parse(std::string_view buffer, frame&);
+
+        // appends an unmasked frame, as sent by servers
+        static void write(
+            string& buffer, opcode, std::string_view payload, bool fin = true);
+
+        // XORs `data` with `mask`, eight bytes at a time
+        static void unmask(char* data, size_t size, const uint8_t mask[4]);
+
+    private: // server thread
+
+        ip::error enqueue(opcode, std::string_view payload);
+        bool      flush();
+        bool      receive(string& input);
+        void      run(ip::socket&, string& input);
+    };
+
+
+    using websocket_ptr = std::shared_ptr<websocket>;
+
+
+    // accepts an upgrade request by setting the websocket's callbacks and
+    // returning true, or refuses it with 403 Forbidden by returning false
+    using websocket_service =
+        std::function<bool(const request&, const websocket_ptr&)>;
+
+
+    /*==========================================================================
+    net::http::channel
+
+    A stream of Server-Sent Events, which server::events() serves to every
+    connection requesting its uri.  publish() serializes an event once into
+    a shared buffer and queues a reference to it for every subscriber; the
+    channel's writer thread sends queued events over non-blocking sockets,
+    so publishing never waits for a subscriber, from any thread.
+
+    A subscriber with `high_water` bytes queued is a slow consumer, which
+    misses events until it catches up (DROP) or is disconnected (DISCONNECT).
+
+    The servers a channel is given to keep a pointer to it, so a channel must
+    outlive them; destroying it first is caught by an assertion.
+    --------------------------------------------------------------------------*/
+    class channel {
+
+        using lock  = std::lock_guard<std::mutex>;
+        using event = std::shared_ptr<const string>;
+
+        struct subscriber;
+        using subscriber_ptr = std::unique_ptr<subscriber>;
+
+    public: // types
+
+        enum policy { DROP, DISCONNECT };
+
+    public: // settings
+
+        size_t high_water = 256 * 1024; // bytes queued per subscriber
+        policy slow       = DROP;
+
+    public: // counters, for tuning
+
+        std::atomic<uint64_t> published    { 0 };
+        std::atomic<uint64_t> dropped      { 0 }; // missed by slow subscribers
+        std::atomic<uint64_t> disconnected { 0 }; // slow subscribers closed
+
+    private:
+
+        mutable std::mutex          mutex;
+        std::vector<subscriber_ptr> subscribers;
+        std::thread                 writer;
+        int                         wakeup   = -1;
+        bool                        stopping = false;
+        std::atomic<unsigned>       served   { 0 }; // by this many servers
+
+        friend class server;
+
+    public: // structors
+
+        channel();
+       ~channel();
+
+        channel(const channel&) = delete;
+        channel& operator=(const channel&) = delete;
+
+    public: // properties
+
+        size_t size() const; // subscribers
+
+    public: // methods
+
+        // `data` may span lines, ended by "\r\n", "\r" or "\n"; `event` and
+        // `id` end at their first line break, and are omitted when empty
+        void publish(
+            std::string_view data,
+            std::string_view event = {},
+            std::string_view id    = {});
+
+        // closes every subscriber's connection
+        void disconnect();
+
+    private:
+
+        void subscribe(ip::socket&&);
+        void wake();
+        void write(); // the writer thread
+    };
+
+
+    /*==========================================================================
+    net::http::tunnel
+
+    A CONNECT tunnel, taken over from the server once a tunnel_service
+    accepts the request.  The connection's thread connects to the `target`
+    the client asked for, answers 200 or 502, then relays bytes both ways,
+    passing on each side's half-close, until both sides have closed or no
+    bytes have moved for `idle_timeout_ms`.
+
+    On Linux the relay moves bytes between the sockets with splice(2)
+    through a pipe in each direction, so they are never copied into the
+    process; elsewhere they pass through a buffer.
+    --------------------------------------------------------------------------*/
+    class tunnel {
+    public: // settings, from the tunnel_service
+
+        int connect_timeout_ms = 10000;
+        int idle_timeout_ms    = 60000; // 0 waits indefinitely
+
+    public: // counters
+
+        std::atomic<uint64_t> sent     { 0 }; // bytes from client to target
+        std::atomic<uint64_t> received { 0 }; // bytes from target to client
+
+    public: // properties
+
+        const std::string target; // "host:port"
+
+    public: // structors
+
+        explicit
+        tunnel(std::string target) : target(std::move(target)) {}
+
+        tunnel(const tunnel&) = delete;
+        tunnel& operator=(const tunnel&) = delete;
+
+    private:
+
+        friend class server;
+
+        // returns OK once connected to the target, or BAD_GATEWAY
+        http::status run(ip::socket& client, string& input);
+    };
+
+
+    using tunnel_ptr = std::shared_ptr<tunnel>;
+
+
+    // accepts a CONNECT request by returning true, after any settings, or
+    // refuses it with 403 Forbidden by returning false
+    using tunnel_service =
+        std::function<bool(const request&, const tunnel_ptr&)>;
+
+
+    /*==========================================================================
+    net::http::codel
+
+    Controlled-delay load shedding.  The server reports how long each request
+    waited between its arrival and the start of its service; when even the
+    shortest wait of an interval exceeded `target_us` the server is
+    overloaded, and until an interval passes below target it sheds requests
+    that waited longer than `target_us`, rather than only those that waited
+    longer than a whole interval.
+
+    Waits are counted in `delays`, bucket i holding those of [2^i, 2^(i+1))
+    microseconds, whether or not shedding is enabled.
+    --------------------------------------------------------------------------*/
+    class codel {
+
+    public: // settings
+
+        int target_us   = 0;   // tolerable wait, 0 to never shed
+        int interval_ms = 100; // how long the wait may stay above target
+
+    public: // counters, for tuning
+
+        enum { BUCKETS = 24 }; // the last bucket is open ended
+
+        std::atomic<uint64_t> served { 0 };
+        std::atomic<uint64_t> shed   { 0 };
+        std::atomic<uint64_t> delays[BUCKETS] = {};
+
+    private:
+
+        std::atomic<int64_t> interval_end { 0 };
+        std::atomic<int64_t> interval_min { INT64_MAX };
+        std::atomic<bool>    overload     { false };
+
+    public: // properties
+
+        bool overloaded() const { return overload.load(); }
+
+    public: // methods
+
+        // records a wait, both in microseconds, returning false to shed it
+        bool admit(int64_t wait_us, int64_t now_us);
+    };
+
+
+    /*==========================================================================
+    net::http::access_log
+
+    A structured access log.  The server pushes a fixed-size record of each
+    exchange into one of a few rings, two per cpu and at least eight: a
+    thread starts from a ring of its own and moves on when another thread is
+    pushing to it, so no thread waits for another.  A record finding every
+    ring busy, or its ring full, is dropped, and `sample` keeps only one of
+    every so many.  A writer thread formats the records as logfmt lines,
+    with the client's address and the request's timings, and writes them to
+    `fd` in large batches every `interval_ms`, or sooner as rings fill.
+
+    e.g. http::access_log log(STDOUT_FILENO);
+         config.log = &log;
+    --------------------------------------------------------------------------*/
+    class access_log {
+    public: // types
+
+        struct record {
+            int64_t     time_us;    // system clock, once answered
+            ip::address peer;
+            uint32_t    wait_us;    // queued before service
+            uint32_t    service_us; // serving and writing the response
+            uint64_t    bytes;      // of the response
+            uint16_t    status;
+            uint8_t     method;
+            uint8_t     uri_size;
+            char        uri[92];    // truncated
+        };
+
+    public: // settings, before the first record
+
+        unsigned sample      = 1;  // keep one record in every `sample`
+        int      interval_ms = 50; // between batches
+
+    public: // counters
+
+        std::atomic<uint64_t> logged  { 0 };
+        std::atomic<uint64_t> dropped { 0 }; // by full or busy rings
+
+    public: // structors
+
+        // writes to `fd`, which it does not close
+        explicit
+        access_log(int fd);
+
+        // writes what is left, then stops its writer
+       ~access_log();
+
+        access_log(const access_log&) = delete;
+        access_log& operator=(const access_log&) = delete;
+
+    public: // methods
+
+        // from any thread, without waiting
+        void push(const record&);
+
+    private:
+
+        struct ring;
+
+        const int                              fd;
+        const unsigned                         count; // of rings, at most
+        std::unique_ptr<std::atomic<ring*>[]>  rings; // added as used
+        std::mutex                             mutex;
+        std::condition_variable                wake;
+        bool                                   stopping = false;
+        std::thread                            writer;
+
+        ring* claim(); // a ring no other thread is pushing to, or null
+        void  write(); // the writer thread
+    };
+
+
+    /*==========================================================================
+    net::http::tracer
+
+    Records the phases of one request in every `sample` as spans, in steady
+    microseconds, into a ring keeping the most recent `capacity`:
+
+        recv     from the bytes' arrival until they are read
+        read     parsing the request
+        service  the service, or whatever took the connection over
+        write    writing the response
+        send     until the response's last byte is sent
+
+    Recording never locks, and chrome_trace() may be called at any time; a
+    span being overwritten meanwhile is left out.  Sampled responses also
+    report their first three phases in a Server-Timing header.
+
+    e.g. http::tracer tracer;
+         config.tracer = &tracer;
+         ...
+         std::ofstream("trace.json") << tracer.chrome_trace();
+    --------------------------------------------------------------------------*/
+    class tracer {
+    public: // types
+
+        enum phase : uint8_t { RECV, READ, SERVICE, WRITE, SEND };
+
+        struct span {
+            uint64_t request;
+            int64_t  start_us;
+            uint32_t duration_us;
+            uint32_t thread;
+            tracer::phase phase;
+        };
+
+    public: // settings
+
+        unsigned sample        = 100;  // trace one request in every `sample`
+        bool     server_timing = true;
+
+    public: // structors
+
+        // keeps the latest `capacity` spans, rounded up to a power of two
+        explicit
+        tracer(size_t capacity = 65536);
+
+        tracer(const tracer&) = delete;
+        tracer& operator=(const tracer&) = delete;
+
+    public: // methods
+
+        // a new request id if the calling thread's next request is sampled,
+        // otherwise 0
+        uint64_t trace();
+
+        void record(uint64_t request, phase, int64_t start_us, int64_t end_us);
+
+        // the kept spans, oldest first
+        std::vector<span> spans() const;
+
+        // the kept spans as trace-event JSON, for chrome://tracing & Perfetto
+        std::string chrome_trace() const;
+
+    private:
+
+        // a seqlock: odd while written, 2 * (index + 1) once written
+        struct slot {
+            std::atomic<uint64_t> sequence { 0 };
+            std::atomic<uint64_t> words[3];
+        };
+
+        const std::unique_ptr<slot[]> slots;
+        const uint64_t                mask;
+        std::atomic<uint64_t>         next     { 0 };
+        std::atomic<uint64_t>         requests { 0 };
+    };
+
+
+    //--------------------------------------------------------------------------
+
+
+    enum engine {
+        ENGINE_DEFAULT, // IO_URING where available, otherwise THREADED
+        THREADED,       // blocking sockets, one thread per connection
+        IO_URING,       // single completion-driven event loop (Linux only)
+    };
+
+
+    /*==========================================================================
+    net::http::config
+
+    Per-deployment server settings.  Socket options are applied to the
+    listener before listen() or to each accepted connection; a value of 0
+    leaves the system default, and options a platform lacks are skipped.
+    Admission limits apply to each client address separately.
+
+    Listing `cpus` pins the server's threads to them: the IO_URING engine
+    runs a loop on each, with a listener of its own sharing the port, while
+    the THREADED engine spreads its connection threads over them.  With
+    `incoming_cpu` a connection is served on the cpu its packets arrive on,
+    when that is one of `cpus`.  Buffers come from the pinned cpu's NUMA
+    node.
+    --------------------------------------------------------------------------*/
+    struct config {
+        http::engine engine = ENGINE_DEFAULT;
+
+        int  backlog      = 0;     // pending connections, 0 for SOMAXCONN
+
+        // listener
+        int  defer_accept = 0;     // seconds to wait for a request's data
+        int  fastopen     = 0;     // TCP Fast Open queue length
+        int  recv_buffer  = 0;     // bytes, inherited by connections
+        int  send_buffer  = 0;     // bytes, inherited by connections
+
+        // connections
+        bool nodelay      = true;  // disable Nagle's algorithm
+        bool quickack     = false; // disable delayed ACKs (Linux)
+        int  busy_poll    = 0;     // microseconds (Linux)
+
+        // admission, per client address; 0 leaves a limit off
+        int  max_connections = 0;  // concurrent, more are refused at accept
+        int  request_rate    = 0;  // requests per second, more get a 503
+        int  request_burst   = 0;  // requests beyond the rate, 0 for a
+                                   // second's worth
+
+        // load shedding, see http::codel; 0 leaves it off
+        int  shed_target_us   = 0;     // tolerable queueing delay
+        int  shed_interval_ms = 100;
+        bool shed_lifo        = false; // serve newest first when overloaded
+
+        // placement (Linux); empty leaves threads to the scheduler
+        std::vector<int> cpus;
+        bool incoming_cpu = false; // steer connections by their packets' cpu
+
+        // records every exchange, if set; outlives the server
+        http::access_log* log = nullptr;
+
+        // samples exchanges' phases, if set; outlives the server
+        http::tracer* tracer = nullptr;
+    };
+
+
     //--------------------------------------------------------------------------
 
 
@@ -434,20 +1684,34 @@ namespace http {
         using lock = std::lock_guard<std::mutex>;
 
         struct client {
-            ip::socket socket;
-            const int  id;
+            ip::socket        socket;
+            const int         id;
+            const ip::address peer;
+            uint32_t          slot = 0; // in the client table
             client(ip::socket&& socket);
            ~client();
         };
 
-        using client_ptr = std::unique_ptr<client>;
-        using client_set = std::unordered_set<client_ptr>;
+        struct uring_loop;
+        struct admission_table;
+        struct client_table;
 
         http::service  service;
-        client_set     clients;
-        std::mutex     clients_mutex;
+        http::websocket_service websocket_service;
+        http::tunnel_service    tunnel_service;
+        std::map<std::string, channel*, std::less<>> channels; // by uri
+        http::config   config;
+        client_table*  clients = nullptr;
         ip::socket     listener;
         std::mutex     listen_mutex;
+        std::atomic<bool> stopping { false };
+        std::atomic<bool> draining { false }; // handed over
+        ip::path       bound;                  // by start(path)
+        int            wakeup[2] = { -1, -1 }; // stops the listen thread
+        std::vector<uring_loop*> urings; // one per config.cpus, or one
+        unsigned       next_cpu = 0;     // the listen thread's turn
+        admission_table* admission = nullptr;
+        http::codel    codel;
 
     public: // structors
 
@@ -459,7 +1723,7 @@ namespace http {
         : service(service)
         { start(port); }
 
-       ~server() { stop(); }
+       ~server();
 
         server(const server&) = delete;
         server& operator=(const server&) = delete;
@@ -477,16 +1741,149 @@ namespace http {
 
         uint16_t port() const;
 
+        // queueing delays and shedding decisions
+        const http::codel& shedding() const { return codel; }
+
     public: // methods
 
-        ip::error start(uint16_t port = 0);
+        ip::error start(uint16_t port = 0, http::engine = ENGINE_DEFAULT);
+
+        ip::error start(uint16_t port, const http::config&);
+
+        // on a local socket, removed again by stop(); config.cpus' loops
+        // share it, and the options of TCP are skipped.  A socket file left
+        // by a server that is gone, so that connecting to it is refused, is
+        // replaced; one that is still served fails with EADDRINUSE
+        ip::error start(const ip::path&, const http::config& = {});
 
         void stop();
 
+        // Hot restart (POSIX): a successor calls inherit() with the same
+        // Unix socket path, or "@name" on Linux, to receive this server's
+        // listening sockets.  This server stops accepting as it hands them
+        // over, so connections wait in the listeners' backlogs while the
+        // successor starts, and resumes should the successor fail.  Once the
+        // successor accepts, this server closes every connection after its
+        // next response, and stops when none is left or `drain_ms` has
+        // passed.  Only a process running as the same user is handed the
+        // listeners; others are turned away.
+        //
+        // e.g. old: server.hand_over("/run/app.sock");
+        //      new: server.inherit("/run/app.sock", config);
+        ip::error hand_over(
+            const char* path, int timeout_ms = 10000, int drain_ms = 30000);
+
+        // starts with a predecessor's listeners rather than binding its own;
+        // `config` should keep the predecessor's engine and cpus
+        ip::error inherit(const char* path, const http::config&);
+
+        // serves "Upgrade: websocket" requests; set before start()
+        void upgrade(http::websocket_service);
+
+        // serves CONNECT requests with tunnels; set before start()
+        void connect(http::tunnel_service);
+
+        // serves `channel` to GET requests for `uri`; set before start(),
+        // and destroy the server before the channel
+        void events(std::string_view uri, http::channel&);
+
+    private: // methods
+
+        // a connection taken over from the request/response exchange
+        struct takeover {
+            websocket_ptr  websocket;
+            tunnel_ptr     tunnel;
+            http::channel* channel = nullptr;
+
+            // a tunnel's exchange, logged once the tunnel has answered
+            access_log::record logged;
+
+            explicit operator bool() const {
+                return websocket or tunnel or channel;
+            }
+        };
+
+        // responses to send: their bytes, and the file slices sent in
+        // between, each before bytes[at]
+        struct outbox {
+            struct slice {
+                file_ptr file;
+                uint64_t offset;
+                uint64_t size;
+                size_t   at;
+            };
+
+            string             bytes;
+            std::vector<slice> slices;
+            uint64_t           traced     = 0; // the last sampled request
+            int64_t            written_us = 0; // when it was written
+
+            bool empty() const { return bytes.empty() and slices.empty(); }
+
+            uint64_t size() const {
+                uint64_t size = bytes.size();
+                for (const slice& s : slices) size += s.size;
+                return size;
+            }
+
+            void clear() { bytes.clear(); slices.clear(); traced = 0; }
+
+            void swap(outbox& o) {
+                bytes.swap(o.bytes);
+                slices.swap(o.slices);
+                std::swap(traced, o.traced);
+                std::swap(written_us, o.written_us);
+            }
+
+            // appends `size` bytes of the response's body from `offset`
+            void append(const response&, uint64_t offset, uint64_t size);
+
+            ip::error send(const ip::socket&) const;
+        };
+
+        // stops once the connection is taken over, setting `taken`;
+        // `arrived` is when `received` was, in steady microseconds
+        bool respond(
+            arena&, request&, response&,
+            string& pending, std::string_view received, outbox& output,
+            takeover& taken, ip::address peer, int64_t arrived);
+
+        // once `output` has been sent
+        void sent(const outbox& output) const;
+
+        // writes `response`, narrowed to the ranges `request` asks for
+        static void reply(
+            const request&, response&, outbox& output, std::string_view date);
+
+        bool upgrade(const request&, response&, string& output, takeover&);
+
+        bool connect(const request&, response&, takeover&);
+
+        bool subscribe(const request&, string& output, takeover&);
+
     private: // threads
 
         void listen();
-        void serve(const client_ptr&);
+        void serve(client&);
+        void drive(uring_loop*);
+        void converse(client&, takeover, string input);
+        void relay(takeover&, ip::socket& client, string& input);
+
+        void configure(ip::socket& connection) const;
+
+        ip::error open_listener(ip::socket&, uint16_t port, int cpu) const;
+
+        // starts serving `listener`, with `inherited` for further loops
+        ip::error run(std::vector<ip::socket> inherited);
+
+        // stops accepting, leaving the listening sockets to a successor,
+        // or accepts again
+        void quiesce();
+        void resume();
+
+        bool accepting(); // the listen thread waits for a connection
+
+        int placement(const ip::socket& connection);
 
     };
 
@@ -2,6 +2,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <iosfwd>
 #include <new>
 #include <string>
@@ -26,8 +27,12 @@ namespace ip {
 
     enum protocol { ANY, TCP, UDP };
 
+    enum family { INET, LOCAL }; // IPv4, or Unix domain (AF_UNIX)
+
     enum iterate { BREAK, CONTINUE };
 
+    enum fill { ZERO_FILL, NO_FILL }; // whether a target is zeroed up front
+
 
     //--------------------------------------------------------------------------
 
@@ -83,6 +88,51 @@ namespace ip {
     std::ostream& operator<<(std::ostream&, const ip::address&);
 
 
+    /*==========================================================================
+    ip::path
+
+    The address of a local (Unix domain) socket: a filesystem path, or on
+    Linux a name in the abstract namespace, written with a leading '@'.
+    A local socket's TCP and UDP stand for stream and datagram.
+
+    e.g. socket.listen(ip::path("/run/app.sock"));
+         socket.connect(ip::path("@app"));
+    --------------------------------------------------------------------------*/
+    struct path {
+
+        enum { SIZE = 108 }; // the longest sun_path, with its terminator
+
+        char name[SIZE] {};
+
+    public: // structors
+
+        path() = default;
+
+        // empty if `name` is too long
+        explicit
+        path(const char* name) {
+            if (strlen(name) < SIZE) strcpy(this->name, name);
+        }
+
+        explicit
+        path(const string& name) : path(name.c_str()) {}
+
+    public: // operators
+
+        explicit operator bool() const { return ok(); }
+
+    public: // properties
+
+        bool ok() const { return name[0] != 0; }
+
+        bool abstract() const { return name[0] == '@'; }
+
+    };
+
+
+    std::ostream& operator<<(std::ostream&, const ip::path&);
+
+
     //--------------------------------------------------------------------------
 
 
@@ -164,16 +214,21 @@ namespace ip {
         target(const target& lv) = default;
         target& operator=(const target& lv) { return assign(this, lv); }
 
-        target(void* head, size_t size)
-        : head(head), size(size) { clear(); }
+        target(void* head, size_t size, ip::fill fill = ZERO_FILL)
+        : head(head), size(size) { if (fill == ZERO_FILL) clear(); }
 
         template <size_t LENGTH>
-        target(char (&str)[LENGTH])
-        : head(str), size(LENGTH - 1) { str[LENGTH - 1] = '\0'; clear(); }
+        target(char (&str)[LENGTH], ip::fill fill = ZERO_FILL)
+        : head(str), size(LENGTH - 1) {
+            str[LENGTH - 1] = '\0';
+            if (fill == ZERO_FILL) clear();
+        }
 
         template <typename T, size_t LENGTH>
-        target(T (&array)[LENGTH])
-        : head(array), size(sizeof(T) * LENGTH) { clear(); }
+        target(T (&array)[LENGTH], ip::fill fill = ZERO_FILL)
+        : head(array), size(sizeof(T) * LENGTH) {
+            if (fill == ZERO_FILL) clear();
+        }
 
         template <typename T>
         explicit
@@ -194,7 +249,7 @@ namespace ip {
             if (bytes >= size) { new(this)target(); return; }
             void* const new_head = (void*)(size_t(head) + bytes);
             const size_t new_size = size - bytes;
-            new(this)target(new_head, new_size);
+            new(this)target(new_head, new_size, NO_FILL);
         }
 
         void clear();
@@ -204,6 +259,68 @@ namespace ip {
     //--------------------------------------------------------------------------
 
 
+    /*==========================================================================
+    net::ip::buffer
+
+    A receive buffer borrowed from a process-wide, lock-free pool of equally
+    sized, unzeroed buffers, and returned to it on destruction.  Borrowing
+    one only once a socket is readable, and returning it once the received
+    bytes are consumed, keeps idle connections from pinning receive memory.
+    Each NUMA node has a pool of its own memory, and a thread borrows from
+    the pool of the node it runs on.
+
+    e.g. ip::buffer block = ip::buffer::borrow();
+         ip::transfer rcvd = socket.recv(block.target());
+    --------------------------------------------------------------------------*/
+    struct buffer {
+
+        enum : size_t { SIZE = 16 * 1024 };
+
+        char* const data = nullptr;
+
+    public: // structors
+
+        static buffer borrow();
+
+        buffer() = default;
+
+        buffer(buffer&& rv) : data(rv.data), slot(rv.slot) { new(&rv)buffer(); }
+
+        buffer& operator=(buffer&& rv) { return assign(this, std::move(rv)); }
+
+        buffer(const buffer&) = delete;
+        buffer& operator=(const buffer&) = delete;
+
+       ~buffer() { if (data) release(slot); }
+
+    public: // operators
+
+        explicit operator bool() const { return ok(); }
+
+    public: // properties
+
+        bool ok() const { return data != nullptr; }
+
+        size_t size() const { return data ? size_t(SIZE) : 0; }
+
+        ip::target target() const { return { data, size(), NO_FILL }; }
+
+        // buffers allocated by the pool so far, borrowed or not
+        static size_t pooled();
+
+    private:
+
+        uint32_t slot = 0;
+
+        buffer(char* data, uint32_t slot) : data(data), slot(slot) {}
+
+        static void release(uint32_t slot);
+    };
+
+
+    //--------------------------------------------------------------------------
+
+
     struct source {
 
         const void* const head = nullptr;
@@ -222,7 +339,8 @@ namespace ip {
         source(const char* str)
         : head(str), size(strlen(str)) {}
 
-        source(const string& str)
+        template <typename Traits, typename Allocator>
+        source(const std::basic_string<char, Traits, Allocator>& str)
         : head(str.data()), size(str.size()) {}
 
         template <typename T, size_t LENGTH>
@@ -245,10 +363,10 @@ namespace ip {
     public: // methods
 
         void advance(size_t bytes) {
-            if (bytes >= size) { new(this)target(); return; }
+            if (bytes >= size) { new(this)source(); return; }
             void* const  new_head = (void*)(size_t(head) + bytes);
             const size_t new_size = size - bytes;
-            new(this)target(new_head, new_size);
+            new(this)source(new_head, new_size);
         }
     };
 
@@ -259,7 +377,7 @@ namespace ip {
     struct transfer {
 
         const size_t    size = 0;
-        const ip::error error;
+        const ip::error error = ip::error::none();
 
     public: // structors
 
@@ -290,6 +408,33 @@ namespace ip {
     //--------------------------------------------------------------------------
 
 
+    /*==========================================================================
+    net::ip::datagram
+
+    One slot of a preallocated batch for socket::recv_batch()/send_batch().
+    With GRO/GSO a slot carries several equally sized datagrams back to back,
+    each `segment` bytes long (the last may be shorter).
+    --------------------------------------------------------------------------*/
+    struct datagram {
+        ip::target  buffer;      // recv: receives the payload
+        ip::source  payload;     // send: the payload to send
+        ip::address peer;        // recv: the sender, send: the destination
+        size_t      size    = 0; // recv: bytes received into `buffer`
+        uint16_t    segment = 0; // GRO/GSO segment size, or 0 if unsegmented
+    };
+
+
+    //--------------------------------------------------------------------------
+
+
+    class reactor;
+
+    template<typename T> struct awaitable;
+
+
+    //--------------------------------------------------------------------------
+
+
     struct socket {
 
         enum : int { INVALID = -1 };
@@ -300,12 +445,12 @@ namespace ip {
 
         socket() = default;
 
-        socket(ip::protocol p) { open(p); }
+        socket(ip::protocol p, ip::family f = INET) { open(p, f); }
 
         explicit
         socket(int id) : id(id) {}
 
-        socket(socket&& rv) : id(rv.id) { new(&rv)socket(); }
+        socket(socket&& rv) : id(rv.release()) {}
 
        ~socket() { close(); }
 
@@ -319,6 +464,12 @@ namespace ip {
 
         ip::address address() const;
 
+        ip::address peer() const; // the connected remote address
+
+        ip::path path() const; // a local socket's bound name
+
+        int incoming_cpu() const; // the cpu its packets arrive on, or -1
+
         static
         bool ok(int id) { return id != INVALID; }
         bool ok() const { return id != INVALID; }
@@ -330,15 +481,20 @@ namespace ip {
         socket accept() const;
 
         error bind(ip::address);
+        error bind(const ip::path&); // opens a local stream socket if need be
 
         error close();
 
+        int release(); // the descriptor, left open; *this becomes empty
+
         error connect(ip::address);
+        error connect(const ip::path&);
 
         error listen(int backlog = 0);
         error listen(ip::address, int backlog = 0); // open(),bind(),listen()
+        error listen(const ip::path&, int backlog = 0);
 
-        error open(ip::protocol);
+        error open(ip::protocol, ip::family = INET);
 
         transfer recv(ip::target) const;
         transfer recvall(ip::target) const;
@@ -346,13 +502,284 @@ namespace ip {
         transfer send(ip::source) const;
         transfer sendall(ip::source) const;
 
+        transfer recvfrom(ip::target, ip::address& from) const;
+        transfer sendto(ip::source, ip::address to) const;
+
+        // local datagrams; `from` is empty for an unbound sender
+        transfer recvfrom(ip::target, ip::path& from) const;
+        transfer sendto(ip::source, const ip::path& to) const;
+
+        // transfer::size counts datagrams; recv_batch() blocks for the first
+        transfer recv_batch(ip::datagram*, size_t count) const;
+        transfer send_batch(ip::datagram*, size_t count) const;
+
+        template<size_t COUNT>
+        transfer recv_batch(ip::datagram (&batch)[COUNT]) const {
+            return recv_batch(batch, COUNT);
+        }
+
+        template<size_t COUNT>
+        transfer send_batch(ip::datagram (&batch)[COUNT]) const {
+            return send_batch(batch, COUNT);
+        }
+
         error shutdown(ip::operation = READ_WRITE);
 
         error setsockopt(int level, int key, ip::source);
         error setsockopt(int level, int key, int value);
         error setsockopt(int level, int key, bool value);
 
+        error nonblocking(bool);
+
+        error gro(bool);          // UDP: coalesce received datagrams (Linux)
+        error gso(uint16_t size); // UDP: default send segment size (Linux)
+
+    public: // tuning; options a platform lacks return ENOPROTOOPT
+
+        error nodelay(bool);          // TCP: send small segments immediately
+        error quickack(bool);         // TCP: ACK at once, until reset (Linux)
+        error defer_accept(int secs); // TCP listener: accept once data arrives
+        error fastopen(int queue);    // TCP listener: accept data in the SYN
+        error fastopen_connect(bool); // TCP: send data in the SYN (Linux)
+        error recv_buffer(int bytes); // set before listen() to be inherited
+        error send_buffer(int bytes);
+        error busy_poll(int usecs);   // poll the device when idle (Linux)
+        error reuse_port(bool);       // share the port, set before bind()
+        error incoming_cpu(int cpu);  // listener: take connections that
+                                      // arrive on `cpu` (Linux)
+        error timeout(int ms);        // blocking calls give up after `ms`,
+                                      // 0 waits indefinitely
+
+    public: // asynchronous api, e.g. `co_await socket.async_recv(target)`
+
+        awaitable<socket>   async_accept() const;
+        awaitable<socket>   async_accept(ip::reactor&) const;
+
+        awaitable<error>    async_connect(ip::address);
+        awaitable<error>    async_connect(ip::address, ip::reactor&);
+
+        awaitable<transfer> async_recv(ip::target) const;
+        awaitable<transfer> async_recv(ip::target, ip::reactor&) const;
+
+        awaitable<transfer> async_send(ip::source) const;
+        awaitable<transfer> async_send(ip::source, ip::reactor&) const;
+
+        awaitable<transfer> async_sendall(ip::source) const;
+        awaitable<transfer> async_sendall(ip::source, ip::reactor&) const;
+
+    };
+
+
+    /*==========================================================================
+    net::ip::reactor
+
+    Completes socket operations when their sockets become ready, on whichever
+    threads call poll() or run().  Any number of threads may drive the same
+    reactor.
+
+    An operation is attempted immediately by submit(), which returns false if
+    it completed without waiting; otherwise `resume(context)` is invoked once
+    it completes, possibly before submit() has even returned.  cancel()
+    withdraws a waiting operation, which is then never resumed; it must not
+    race a poll() completing that same operation.
+
+    Listening and connecting sockets are made non-blocking while their
+    operation waits, and blocking again once it completes.
+    --------------------------------------------------------------------------*/
+    class reactor {
+
+        struct state;
+        state* const _state;
+
+    public: // types
+
+        struct operation {
+            enum kind { ACCEPT, CONNECT, RECV, SEND, SENDALL };
+
+            const kind       type;
+            const int        socket;
+            ip::target       target;
+            ip::source       source;
+            ip::address      address;
+            size_t           size     = 0;
+            ip::error        error    = ip::error::none();
+            int              accepted = socket::INVALID;
+            bool             started  = false;
+            void*            context  = nullptr;
+            void           (*resume)(void*) = nullptr;
+
+            operation(kind type, int socket) : type(type), socket(socket) {}
+        };
+
+    public: // structors
+
+        reactor();
+       ~reactor();
+
+        reactor(const reactor&) = delete;
+        reactor& operator=(const reactor&) = delete;
+
+        static reactor& shared();
+
+    public: // properties
+
+        size_t pending() const; // submitted, but not yet completed
+
+    public: // methods
+
+        bool submit(operation&);
+
+        // withdraws `op` if it is still waiting
+        void cancel(operation& op);
+
+        // completes ready operations, waiting up to `timeout_ms` (-1: forever)
+        size_t poll(int timeout_ms = -1);
+
+        // completes operations until stop() is called
+        void run();
+
+        void stop();
+
+    };
+
+
+    /*==========================================================================
+    net::ip::awaitable<T>
+
+    The result of socket::async_*(); suspends the awaiting coroutine until its
+    reactor completes the operation.  Destroying a coroutine suspended on one
+    cancels the operation.
+    --------------------------------------------------------------------------*/
+    template<typename T>
+    struct awaitable {
+
+        ip::reactor&           reactor;
+        ip::reactor::operation operation;
+        bool                   waiting = false;
+
+       ~awaitable() { if (waiting) reactor.cancel(operation); }
+
+        bool await_ready() const { return false; }
+
+        template<typename Handle>
+        bool await_suspend(Handle handle) {
+            operation.context = handle.address();
+            operation.resume  = [](void* address) {
+                Handle::from_address(address).resume();
+            };
+            waiting = true; // until await_resume()
+            return reactor.submit(operation);
+        }
+
+        T await_resume();
     };
 
 
+    template<> inline
+    socket
+    awaitable<socket>::await_resume() {
+        waiting = false;
+        return socket(operation.accepted);
+    }
+
+
+    template<> inline
+    error
+    awaitable<error>::await_resume() {
+        waiting = false;
+        return operation.error;
+    }
+
+
+    template<> inline
+    transfer
+    awaitable<transfer>::await_resume() {
+        waiting = false;
+        return { operation.size, operation.error };
+    }
+
+
+    //--------------------------------------------------------------------------
+
+
+    inline
+    awaitable<socket>
+    socket::async_accept(ip::reactor& r) const {
+        return { r, { reactor::operation::ACCEPT, id } };
+    }
+
+
+    inline
+    awaitable<error>
+    socket::async_connect(ip::address a, ip::reactor& r) {
+        const error err = ok() ? error::none() : open(a.protocol);
+        awaitable<error> result { r, { reactor::operation::CONNECT, id } };
+        result.operation.address = a;
+        result.operation.error   = err; // completes immediately if set
+        return result;
+    }
+
+
+    inline
+    awaitable<transfer>
+    socket::async_recv(ip::target t, ip::reactor& r) const {
+        awaitable<transfer> result { r, { reactor::operation::RECV, id } };
+        result.operation.target = t;
+        return result;
+    }
+
+
+    inline
+    awaitable<transfer>
+    socket::async_send(ip::source s, ip::reactor& r) const {
+        awaitable<transfer> result { r, { reactor::operation::SEND, id } };
+        result.operation.source = s;
+        return result;
+    }
+
+
+    inline
+    awaitable<transfer>
+    socket::async_sendall(ip::source s, ip::reactor& r) const {
+        awaitable<transfer> result { r, { reactor::operation::SENDALL, id } };
+        result.operation.source = s;
+        return result;
+    }
+
+
+    inline
+    awaitable<socket>
+    socket::async_accept() const {
+        return async_accept(reactor::shared());
+    }
+
+
+    inline
+    awaitable<error>
+    socket::async_connect(ip::address a) {
+        return async_connect(a, reactor::shared());
+    }
+
+
+    inline
+    awaitable<transfer>
+    socket::async_recv(ip::target t) const {
+        return async_recv(t, reactor::shared());
+    }
+
+
+    inline
+    awaitable<transfer>
+    socket::async_send(ip::source s) const {
+        return async_send(s, reactor::shared());
+    }
+
+
+    inline
+    awaitable<transfer>
+    socket::async_sendall(ip::source s) const {
+        return async_sendall(s, reactor::shared());
+    }
+
+
 }} // namespace net::ip
@@ -1,6 +1,20 @@
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <future>
 #include <thread>
 #include <net/http.h>
+#if defined(__cpp_impl_coroutine)
+    #include <net/async.h>
+#endif
+#if !NET_PLATFORM_WINDOWS
+    #include <fcntl.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
 #include "tests.h"
 
 
@@ -56,3 +70,1152 @@ TEST("net::http::response::read() - implicit Content-Length") {
     res.content = "Hello World\n";
     CHECK(res.write() == expected);
 }
+
+
+TEST("net::http::request::parse() - refuses a length it cannot frame") {
+    const char* const lengths[] = {
+        "-5", "5x", "", "18446744073709551615", "99999999999999999999" };
+    for (const char* length : lengths) {
+        const std::string field =
+            "Content-Length: " + std::string(length) + "\r\n\r\n";
+        const std::string head = "GET / HTTP/1.1\r\n" + field;
+        request q;
+        CHECK(q.parse(head + "GET /next HTTP/1.1\r\n\r\n") == head.size());
+        CHECK(not q.ok());
+        const std::string status = "HTTP/1.1 200 OK\r\n" + field;
+        response r;
+        CHECK(r.parse(status + "body") == status.size());
+        CHECK(not r.ok());
+    }
+    request q;
+    const std::string framed = "GET / HTTP/1.1\r\nContent-Length: 2\r\n\r\nhi";
+    CHECK(q.parse(framed + "GET") == framed.size());
+    CHECK(q.ok() and q.content == "hi");
+}
+
+
+TEST("net::http::request::reset() - starts over on an arena") {
+    arena exchange;
+    request req(exchange);
+    req.uri     = "/x";
+    req.content = "body";
+    req.headers.set("Host", "localhost");
+    req.reset(exchange);
+    exchange.release();
+    CHECK(not req.ok() and req.uri.empty() and req.content.empty());
+    CHECK(not req.headers.has("Host"));
+#if !NET_HTTP_PMR
+    std::string& content = req.content; // the standard string, by default
+    content = "again";
+    CHECK(req.content == "again");
+#endif
+}
+
+
+TEST("net::http::string_to() - strict numeric parsing") {
+    int i = -1;
+    CHECK(string_to("1234", i) and i == 1234);
+    CHECK(not string_to("12x", i) and i == 1234);
+    CHECK(not string_to("99999999999", i) and i == 1234);
+    CHECK(not string_to("", i));
+    unsigned long long u = 0;
+    CHECK(not string_to("-1", u));
+    CHECK(string_to<double>("2.5") == 2.5);
+    pairs p;
+    p.set("Content-Length", "abc");
+    CHECK(p.get<size_t>("Content-Length", 7) == 7);
+}
+
+
+TEST("net::http::query - decoding and repeated keys") {
+    const request req =
+        "GET /search?q=a+b%26c&tag=x&tag=y&raw HTTP/1.1\r\n"
+        "\r\n";
+    CHECK(req.query.str() == "q=a+b%26c&tag=x&tag=y&raw");
+    CHECK(req.query["q"] == "a b&c");
+    CHECK(req.query["tag"] == "x");
+    CHECK(req.query.pairs().size() == 4);
+    CHECK(req.query.has("raw"));
+    size_t raw_pairs = 0;
+    for (auto pair : req.query.raw()) {
+        if (raw_pairs++ == 0) CHECK(pair.second == "a+b%26c");
+    }
+    CHECK(raw_pairs == 4);
+}
+
+
+TEST("net::http::query - empty items, trailing or repeated '&'") {
+    const request trailing = "GET /x?a=1& HTTP/1.1\r\n\r\n";
+    CHECK(trailing.query["a"] == "1");
+    CHECK(not trailing.query.has("b"));
+    CHECK(trailing.query.pairs().size() == 1);
+
+    const request repeated = "GET /x?&&a=1&&b=2&& HTTP/1.1\r\n\r\n";
+    size_t raw_pairs = 0;
+    for (auto pair : repeated.query.raw()) raw_pairs += not pair.first.empty();
+    CHECK(raw_pairs == 2);
+    CHECK(repeated.query["b"] == "2");
+    CHECK(repeated.query.pairs().size() == 2);
+}
+
+
+TEST("net::ip::buffer - pooled buffers are reused") {
+    char* last = nullptr;
+    {
+        net::ip::buffer a = net::ip::buffer::borrow();
+        net::ip::buffer b = net::ip::buffer::borrow();
+        CHECK(a and b and a.data != b.data);
+        CHECK(a.target().size == net::ip::buffer::SIZE);
+        last = a.data; // destroyed after b
+    }
+    net::ip::buffer c = net::ip::buffer::borrow();
+    CHECK(c.data == last); // most recently returned first
+}
+
+
+TEST("net::ip::buffer::pooled() - grows by slabs, counts every node's pool") {
+    // every free buffer, and then some, so that the pool must grow
+    const size_t before = net::ip::buffer::pooled();
+    std::vector<net::ip::buffer> borrowed;
+    for (size_t i = 0; i <= before; ++i) {
+        borrowed.push_back(net::ip::buffer::borrow());
+        CHECK(borrowed.back().ok());
+    }
+    const size_t grown = net::ip::buffer::pooled();
+    CHECK(grown > before and grown >= borrowed.size());
+
+    // borrowed on threads that may run on other nodes, released here
+    std::vector<net::ip::buffer> elsewhere(std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (auto& b : elsewhere) {
+        threads.emplace_back([&b] { b = net::ip::buffer::borrow(); });
+    }
+    for (auto& thread : threads) thread.join();
+    for (auto& b : elsewhere) CHECK(b.ok());
+    const size_t all = net::ip::buffer::pooled();
+    elsewhere.clear();
+    CHECK(net::ip::buffer::pooled() == all); // back to their pools, kept
+
+    // released on another thread, each returns to its pool for reuse
+    std::vector<char*> released;
+    for (auto& b : borrowed) released.push_back(b.data);
+    std::thread([&borrowed] { borrowed.clear(); }).join();
+    net::ip::buffer again = net::ip::buffer::borrow();
+    CHECK(std::count(released.begin(), released.end(), again.data) == 1);
+    CHECK(net::ip::buffer::pooled() == all);
+}
+
+
+TEST("net::http::websocket - handshake key and framing") {
+    CHECK(websocket::accept_key("dGhlIHNhbXBsZSBub25jZQ==")
+          == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+
+    const net::http::string payload(300, 'w');
+    net::http::string buffer;
+    websocket::write(buffer, websocket::BINARY, payload);
+    websocket::frame f;
+    CHECK(websocket::parse(std::string_view(buffer).substr(0, 3), f) == 0);
+    CHECK(websocket::parse(buffer, f) == 4);
+    CHECK(f.fin and f.type == websocket::BINARY and f.size == 300);
+
+    const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    char masked[] = "Hello, websocket";
+    websocket::unmask(masked, sizeof(masked) - 1, mask);
+    CHECK(uint8_t(masked[0]) == ('H' ^ 0x37));
+    websocket::unmask(masked, sizeof(masked) - 1, mask);
+    CHECK(std::string_view(masked) == "Hello, websocket");
+}
+
+
+TEST("net::http::codel - sheds once the wait stays above target") {
+    net::http::codel codel;
+    codel.target_us   = 1000;
+    codel.interval_ms = 100;
+    CHECK(codel.admit(5000, 1));           // opens the first interval
+    CHECK(codel.admit(5000, 50000));
+    CHECK(not codel.admit(200000, 60000)); // longer than an interval
+    CHECK(not codel.admit(5000, 100001));  // every wait was above target
+    CHECK(codel.overloaded());
+    CHECK(codel.admit(10, 150000));
+    CHECK(codel.admit(10, 200002));        // the interval came back down
+    CHECK(not codel.overloaded());
+    CHECK(codel.shed == 2 and codel.served == 4);
+    CHECK(codel.delays[3] == 2 and codel.delays[12] == 3);
+}
+
+
+TEST("net::http::headers - well-known names ignore case") {
+    CHECK(string_to_header("content-LENGTH") == CONTENT_LENGTH);
+    CHECK(string_to_header("X-Content-Length") == HEADER_UNKNOWN);
+    CHECK(iequals("Sec-WebSocket-Version", "sec-websocket-version"));
+    CHECK(not iequals("Content-Length", "Content_Length"));
+
+    const request req =
+        "POST / HTTP/1.1\r\n"
+        "X-Content-Length: 99\r\n"
+        "content-length: 4\r\n"
+        "CONNECTION: close\r\n"
+        "X-Custom: a\r\n"
+        "\r\n"
+        "body";
+    CHECK(req.content == "body");
+    CHECK(req.headers.get(CONTENT_LENGTH) == "4");
+    CHECK(req.headers["Connection"] == "close");
+    CHECK(req.headers.get<int>("X-Content-Length") == 99);
+    CHECK(req.headers.has("X-Custom") and not req.headers.has("x-custom"));
+    size_t canonical = 0;
+    for (auto& pair : req.headers) canonical += (pair.first == "Connection");
+    CHECK(canonical == 1);
+}
+
+
+TEST("net::http::parse_ranges - clamps to the body, or ignores the header") {
+    std::vector<byte_range> r;
+    CHECK(parse_ranges("bytes=0-99, 200-,-50", 1000, r) and r.size() == 3);
+    CHECK(r[0].first == 0   and r[0].last == 99);
+    CHECK(r[1].first == 200 and r[1].last == 999);
+    CHECK(r[2].first == 950 and r[2].last == 999);
+    CHECK(parse_ranges("Bytes=500-2000,-2000", 1000, r) and r.size() == 2);
+    CHECK(r[0].last == 999 and r[1].first == 0);
+    CHECK(parse_ranges("bytes=1000-,-0", 1000, r) and r.empty());
+    CHECK(not parse_ranges("bytes=9-1", 1000, r));
+    CHECK(not parse_ranges("bytes=1-2-3", 1000, r));
+    CHECK(not parse_ranges("items=0-1", 1000, r));
+    CHECK(not parse_ranges("bytes=", 1000, r));
+}
+
+
+TEST("net::http::tracer - keeps the latest spans of sampled requests") {
+    tracer t(3); // rounded up to 4
+    t.sample = 2;
+    const uint64_t first = t.trace();
+    CHECK(first != 0 and t.trace() == 0 and t.trace() == first + 1);
+    for (int64_t i = 0; i < 6; ++i) {
+        t.record(first, tracer::SERVICE, i * 10, i * 10 + i);
+    }
+    const std::vector<tracer::span> spans = t.spans();
+    CHECK(spans.size() == 4);
+    CHECK(spans.front().start_us == 20 and spans.back().duration_us == 5);
+    CHECK(t.chrome_trace().find("\"name\":\"service\"") != std::string::npos);
+}
+
+
+TEST("net::http::hedging - delay from recorded latencies, wins capped") {
+    hedging policy;
+    policy.min_delay_ms = 2;
+    policy.max_delay_ms = 50;
+    CHECK(policy.delay_ms() == 50); // too few calls yet
+    for (int i = 0; i < 15; ++i) policy.record(1000);
+    CHECK(policy.delay_ms() == 50);
+    policy.record(1000);
+    CHECK(policy.delay_ms() == 2); // p95 of 1ms, raised to the minimum
+
+    // the first call stalls, so its hedge answers first
+    std::atomic<int> calls { 0 };
+    server slow([&](const request&, response& r) {
+        if (calls++ == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        }
+        r.status  = OK;
+        r.content = "done";
+    });
+    CHECK(not slow.start(0, THREADED));
+    hedging fresh;
+    fresh.percentile = 1.0;
+    for (int i = 0; i < 15; ++i) fresh.record(1000);
+    fresh.record(20000);
+    CHECK(fresh.delay_ms() == 20);
+    const request q(GET,
+        string("http://127.0.0.1:" + std::to_string(slow.port()) + "/"));
+    const response r = q.send(fresh);
+    CHECK(r.status == OK and r.content == "done");
+    CHECK(fresh.hedges == 1 and fresh.wins == 1);
+    CHECK(fresh.delay_ms() == 20); // the delay, not the delay and the hedge
+    slow.stop();
+}
+
+
+TEST("net::http::channel - line breaks cannot start fields of their own") {
+    channel events; // outlives the server
+    server sse([](const request&, response& r) { r.status = NOT_FOUND; });
+    sse.events("/events", events);
+    CHECK(not sse.start(0, THREADED));
+    const std::string address = "127.0.0.1:" + std::to_string(sse.port());
+    net::ip::socket client;
+    CHECK(not client.connect(
+        net::ip::address(net::ip::TCP, address.c_str())));
+    client.sendall(std::string("GET /events HTTP/1.1\r\n\r\n"));
+    for (int i = 0; i < 1000 and events.size() == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(events.size() == 1);
+
+    events.publish("a\rid: 7\r\nb\nc", "tick\rdata: x", "1\n2");
+    const std::string_view expected =
+        "event: tick\n"
+        "id: 1\n"
+        "data: a\n"
+        "data: id: 7\n"
+        "data: b\n"
+        "data: c\n"
+        "\n";
+    std::string stream;
+    char block[512];
+    net::ip::transfer tx;
+    while (stream.size() < expected.size() or
+           stream.compare(stream.size() - 2, 2, "\n\n") != 0) {
+        tx = client.recv({ block, net::ip::NO_FILL });
+        if (tx.error or tx.size == 0) break;
+        stream.append(block, tx.size);
+    }
+    CHECK(stream.find("HTTP/1.1 200") == 0);
+    const size_t body = stream.find("\r\n\r\n") + 4;
+    CHECK(std::string_view(stream).substr(body) == expected);
+
+    events.disconnect();
+    tx = client.recv({ block, net::ip::NO_FILL });
+    CHECK(not tx.error and tx.size == 0);
+    sse.stop();
+}
+
+
+TEST("net::ip::reactor - completes, cancels, restores blocking") {
+    using net::ip::reactor;
+    reactor r;
+    net::ip::socket listener;
+    CHECK(not listener.open(net::ip::TCP));
+    CHECK(not listener.bind(uint16_t(0)) and not listener.listen());
+
+    int resumed = 0;
+    auto count = [](void* context) { *(int*)context += 1; };
+    reactor::operation accept(reactor::operation::ACCEPT, listener.id);
+    accept.context = &resumed;
+    accept.resume  = count;
+    CHECK(r.submit(accept) and r.pending() == 1);
+    net::ip::socket client;
+    const std::string address = "127.0.0.1:" + std::to_string(listener.port());
+    CHECK(not client.connect(
+        net::ip::address(net::ip::TCP, address.c_str())));
+    for (int i = 0; i < 100 and not resumed; ++i) r.poll(10);
+    CHECK(resumed == 1 and r.pending() == 0 and not accept.error);
+    net::ip::socket server(accept.accepted);
+    CHECK(server.ok());
+#if !NET_PLATFORM_WINDOWS
+    CHECK(not (fcntl(listener.id, F_GETFL) & O_NONBLOCK));
+#endif
+
+    char block[16];
+    reactor::operation recv(reactor::operation::RECV, server.id);
+    recv.target  = { block, net::ip::NO_FILL };
+    recv.context = &resumed;
+    recv.resume  = count;
+    CHECK(r.submit(recv));
+    r.cancel(recv);
+    CHECK(r.pending() == 0);
+    client.sendall(std::string("ping"));
+    r.poll(50);
+    CHECK(resumed == 1); // never resumed once cancelled
+
+    CHECK(not r.submit(recv)); // already readable, so done without waiting
+    CHECK(resumed == 1 and recv.size == 4);
+    CHECK(std::string_view(block, recv.size) == "ping");
+
+    reactor::operation waits(reactor::operation::RECV, client.id);
+    waits.target  = { block, net::ip::NO_FILL };
+    waits.context = &resumed;
+    waits.resume  = count;
+    CHECK(r.submit(waits));
+    server.sendall(std::string("pong"));
+    for (int i = 0; i < 100 and resumed == 1; ++i) r.poll(10);
+    CHECK(resumed == 2 and waits.size == 4 and r.pending() == 0);
+}
+
+
+#if defined(__cpp_impl_coroutine)
+
+
+TEST("net::http::async_send - a task round trip, a destroyed one cancels") {
+    server echo([](const request& q, response& r) {
+        r.status  = OK;
+        r.content = q.uri.substr(q.uri.find('/')); // after host:port
+    });
+    CHECK(not echo.start(0, THREADED));
+    const std::string address = "127.0.0.1:" + std::to_string(echo.port());
+    net::ip::reactor r;
+
+    auto twice = [&]() -> net::task<std::string> {
+        const request first(GET, string(address + "/a"));
+        const request second(GET, string(address + "/b"));
+        const response a = co_await async_send(first, r);
+        const response b = co_await async_send(second, r);
+        co_return std::string(a.content) + std::string(b.content);
+    };
+    CHECK(net::sync_wait(twice(), r) == "/a/b");
+
+    // a task suspended on a recv, destroyed before anything arrives
+    net::ip::socket client;
+    CHECK(not client.connect(
+        net::ip::address(net::ip::TCP, address.c_str())));
+    auto waits = [&]() -> net::task<size_t> {
+        char block[16];
+        net::ip::transfer tx =
+            co_await client.async_recv({ block, net::ip::NO_FILL }, r);
+        co_return tx.size;
+    };
+    {
+        net::task<size_t> t = waits();
+        t.await_suspend(std::noop_coroutine()).resume(); // runs to the recv
+        CHECK(r.pending() == 1);
+    }
+    CHECK(r.pending() == 0);
+    echo.stop();
+}
+
+
+#endif // __cpp_impl_coroutine
+
+
+TEST("net::http::server - reuses client slots, stop() closes every client") {
+    server threaded([](const request&, response& r) { r.status = OK; });
+    CHECK(not threaded.start(0, THREADED));
+    const std::string address =
+        "127.0.0.1:" + std::to_string(threaded.port());
+    auto answered = [](net::ip::socket& s) {
+        s.sendall(std::string("GET / HTTP/1.1\r\n\r\n"));
+        char block[512];
+        const net::ip::transfer tx = s.recv({ block, net::ip::NO_FILL });
+        return not tx.error and tx.size > 0;
+    };
+
+    // more clients than a chunk of slots holds, then half of them replaced
+    enum { CLIENTS = 300 };
+    std::vector<net::ip::socket> clients(CLIENTS);
+    size_t ok = 0;
+    for (auto& c : clients) {
+        if (c.connect(net::ip::address(net::ip::TCP, address.c_str()))) break;
+        ok += answered(c);
+    }
+    for (size_t i = 0; i < CLIENTS; i += 2) clients[i].close();
+    for (size_t i = 0; i < CLIENTS; i += 2) {
+        net::ip::socket& c = clients[i];
+        if (c.connect(net::ip::address(net::ip::TCP, address.c_str()))) break;
+        ok += answered(c);
+    }
+    CHECK(ok == CLIENTS + CLIENTS / 2);
+
+    threaded.stop();
+    size_t closed = 0;
+    for (auto& c : clients) {
+        char block[64];
+        const net::ip::transfer tx = c.recv({ block, net::ip::NO_FILL });
+        closed += (tx.error or tx.size == 0);
+    }
+    CHECK(closed == CLIENTS);
+}
+
+
+#if NET_PLATFORM_LINUX
+
+
+TEST("net::ip::path - abstract stream round trip and datagrams") {
+    const net::ip::path name("@net-test");
+    server local([](const request& q, response& r) {
+        r.status  = OK;
+        r.content = q.uri;
+    });
+    CHECK(not local.start(name));
+    const response r = request(GET, "/local").send(name);
+    CHECK(r.status == OK and r.content == "/local");
+    local.stop();
+
+    net::ip::socket a, b;
+    CHECK(not a.open(net::ip::UDP, net::ip::LOCAL));
+    CHECK(not b.open(net::ip::UDP, net::ip::LOCAL));
+    CHECK(not a.bind(net::ip::path("@net-test-a")));
+    CHECK(not b.bind(net::ip::path("@net-test-b")));
+    CHECK(a.sendto(std::string("hello"), net::ip::path("@net-test-b")).size
+          == 5);
+    char block[16];
+    net::ip::path from;
+    const net::ip::transfer tx = b.recvfrom({ block, net::ip::NO_FILL }, from);
+    CHECK(not tx.error and std::string_view(block, tx.size) == "hello");
+    CHECK(std::string_view(from.name) == "@net-test-a");
+}
+
+
+#endif // NET_PLATFORM_LINUX
+
+
+#if !NET_PLATFORM_WINDOWS
+
+
+TEST("net::http::server::start(path) - replaces a stale socket file") {
+    char name[] = "/tmp/net-test-XXXXXX";
+    const int file = mkstemp(name);
+    CHECK(file >= 0);
+    ::close(file);
+    std::remove(name);
+    const net::ip::path path(name);
+
+    {   // bound, then closed without removing its file
+        net::ip::socket gone;
+        CHECK(not gone.bind(path) and not gone.listen());
+    }
+    server fresh([](const request&, response& r) { r.status = OK; });
+    CHECK(not fresh.start(path));
+    CHECK(request(GET, "/").send(path).status == OK);
+
+    server second([](const request&, response& r) { r.status = OK; });
+    CHECK(second.start(path).id == EADDRINUSE); // still served
+    fresh.stop();
+    CHECK(not std::ifstream(name)); // stop() removed it
+}
+
+
+TEST("net::http::server::hand_over() - a successor inherits the listener") {
+    for (const engine e : { ENGINE_DEFAULT, THREADED }) {
+        char name[] = "/tmp/net-test-XXXXXX";
+        const int file = mkstemp(name);
+        CHECK(file >= 0);
+        ::close(file);
+        std::remove(name);
+
+        auto answer = [](const char* body) {
+            return [body](const request&, response& r) {
+                r.status  = OK;
+                r.content = body;
+            };
+        };
+        auto exchange = [](net::ip::socket& s, response& r) {
+            s.sendall(std::string("GET / HTTP/1.1\r\n\r\n"));
+            string input;
+            char block[1024];
+            net::ip::transfer tx;
+            while ((tx = s.recv({ block, net::ip::NO_FILL })) and tx.size) {
+                input.append(block, tx.size);
+                if (r.read(input)) return true;
+            }
+            return false;
+        };
+
+        server old(answer("old"));
+        CHECK(not old.start(0, e));
+        const net::ip::address address(127, 0, 0, 1, old.port(), net::ip::TCP);
+        net::ip::socket kept;
+        CHECK(not kept.connect(address));
+        response r;
+        CHECK(exchange(kept, r) and r.content == "old");
+
+        auto handing = std::async(std::launch::async, [&] {
+            return old.hand_over(name, 2000, 2000);
+        });
+        for (int i = 0; i < 1000 and ::access(name, F_OK) != 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        config settings;
+        settings.engine = e;
+        server successor(answer("new"));
+        CHECK(not successor.inherit(name, settings));
+        CHECK(successor.port() == address.port);
+
+        // the predecessor answers its kept connection until it learns that
+        // the successor has started, then closes it after a last response
+        bool closed = false;
+        for (int i = 0; i < 200 and not closed; ++i) {
+            response last;
+            CHECK(exchange(kept, last) and last.content == "old");
+            closed = (last.headers["Connection"] == "close");
+            if (not closed) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        CHECK(closed);
+        char c;
+        CHECK(kept.recv({ &c, 1, net::ip::NO_FILL }).size == 0);
+        CHECK(not handing.get() and not old.ok());
+
+        net::ip::socket fresh;
+        CHECK(not fresh.connect(address));
+        CHECK(exchange(fresh, r) and r.content == "new");
+        successor.stop();
+    }
+}
+
+
+#endif // !NET_PLATFORM_WINDOWS
+
+
+TEST("net::ip::socket::release() - gives up the descriptor, open") {
+    net::ip::socket s;
+    CHECK(not s.open(net::ip::TCP));
+    const int fd = s.release();
+    CHECK(not s.ok() and fd >= 0);
+    net::ip::socket owner(fd); // closes it
+    CHECK(owner.ok() and not owner.bind(uint16_t(0)) and owner.port() != 0);
+}
+
+
+TEST("net::http::request::send() - with Fast Open on both ends") {
+    config settings;
+    settings.engine   = THREADED;
+    settings.fastopen = 16;
+    server tfo([](const request& q, response& r) {
+        r.status  = OK;
+        r.content = q.uri.substr(q.uri.find('/')); // after host:port
+    });
+    CHECK(not tfo.start(0, settings));
+    const std::string host = "127.0.0.1:" + std::to_string(tfo.port());
+    for (int i = 0; i < 3; ++i) { // the first fetches a cookie, if enabled
+        const std::string path = "/" + std::to_string(i);
+        const response r = request(GET, string(host + path)).send();
+        CHECK(r.status == OK and std::string_view(r.content) == path);
+    }
+    CHECK(request(GET, "127.0.0.1:1/").send().status != OK); // refused
+    tfo.stop();
+}
+
+
+TEST("net::http::server - pipelined and split requests answer in order") {
+    for (const engine e : { ENGINE_DEFAULT, THREADED }) {
+        server ordered([](const request& q, response& r) {
+            r.status  = OK;
+            r.content = q.uri;
+        });
+        CHECK(not ordered.start(0, e));
+        const std::string address =
+            "127.0.0.1:" + std::to_string(ordered.port());
+        net::ip::socket client;
+        CHECK(not client.connect(
+            net::ip::address(net::ip::TCP, address.c_str())));
+
+        // twenty requests in one send, then one a byte at a time
+        enum { PIPELINED = 20 };
+        std::string batch;
+        for (int i = 0; i < PIPELINED; ++i) {
+            batch += "GET /" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+        }
+        client.sendall(batch);
+        const std::string split = "GET /split HTTP/1.1\r\n\r\n";
+        for (const char c : split) {
+            client.sendall(std::string(1, c));
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+
+        std::vector<std::string> answers;
+        std::string input;
+        char block[4096];
+        while (answers.size() < PIPELINED + 1) {
+            const net::ip::transfer tx =
+                client.recv({ block, net::ip::NO_FILL });
+            if (tx.error or tx.size == 0) break;
+            input.append(block, tx.size);
+            response r;
+            while (size_t length = r.parse(input)) {
+                answers.push_back(std::string(r.content));
+                input.erase(0, length);
+            }
+        }
+        CHECK(answers.size() == PIPELINED + 1);
+        for (size_t i = 0; i < answers.size(); ++i) {
+            const std::string uri =
+                (i < PIPELINED) ? "/" + std::to_string(i) : "/split";
+            CHECK(answers[i] == uri);
+        }
+        ordered.stop();
+    }
+}
+
+
+TEST("net::http::server - a negative Content-Length is refused, closing") {
+    for (const engine e : { ENGINE_DEFAULT, THREADED }) {
+        std::atomic<int> served { 0 };
+        server strict([&served](const request&, response& r) {
+            served += 1;
+            r.status = OK;
+        });
+        CHECK(not strict.start(0, e));
+        const std::string address =
+            "127.0.0.1:" + std::to_string(strict.port());
+        net::ip::socket client;
+        CHECK(not client.connect(
+            net::ip::address(net::ip::TCP, address.c_str())));
+        client.sendall(std::string(
+            "GET / HTTP/1.1\r\nContent-Length: -5\r\n\r\n"
+            "GET /next HTTP/1.1\r\n\r\n"));
+
+        std::string input;
+        char block[4096];
+        net::ip::transfer tx;
+        while ((tx = client.recv({ block, net::ip::NO_FILL })) and tx.size) {
+            input.append(block, tx.size);
+        }
+        response r;
+        CHECK(r.parse(input) == input.size());
+        CHECK(r.status == BAD_REQUEST);
+        CHECK(r.headers.get("Connection") == "close");
+        CHECK(served == 0);
+        strict.stop();
+    }
+}
+
+
+TEST("net::http::send_many() - pipelined HEAD, 1xx and 204 have no body") {
+    // answers four pipelined requests at once, after an interim 100
+    net::ip::socket upstream;
+    CHECK(not upstream.listen(
+        net::ip::address(net::ip::TCP, "127.0.0.1:0")));
+    std::thread answering([&upstream] {
+        net::ip::socket c = upstream.accept();
+        std::string input;
+        char block[4096];
+        net::ip::transfer tx;
+        size_t heads = 0;
+        while (heads < 4 and (tx = c.recv({ block, net::ip::NO_FILL }))
+               and tx.size) {
+            input.append(block, tx.size);
+            heads = 0;
+            for (size_t at = 0;
+                 (at = input.find("\r\n\r\n", at)) != input.npos; at += 4) {
+                heads += 1;
+            }
+        }
+        c.sendall(std::string(
+            "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n"
+            "HTTP/1.1 100 Continue\r\n\r\n"
+            "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/b"
+            "HTTP/1.1 204 No Content\r\nContent-Length: 5\r\n\r\n"
+            "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/d"));
+    });
+
+    const std::string host = "127.0.0.1:" + std::to_string(upstream.port());
+    const std::vector<request> requests = {
+        request(HEAD, string(host + "/a")),
+        request(GET,  string(host + "/b")),
+        request(GET,  string(host + "/c")),
+        request(GET,  string(host + "/d")),
+    };
+    std::vector<std::string> answers(requests.size(), "unanswered");
+    std::vector<int> statuses(requests.size(), 0);
+    send_many(requests, 2000, [&](size_t i, response& r, net::ip::error e) {
+        answers[i]  = e ? "failed" : std::string(r.content);
+        statuses[i] = r.status;
+    });
+    answering.join();
+    CHECK(statuses[0] == OK and answers[0].empty());
+    CHECK(statuses[1] == OK and answers[1] == "/b");
+    CHECK(statuses[2] == NO_CONTENT and answers[2].empty());
+    CHECK(statuses[3] == OK and answers[3] == "/d");
+}
+
+
+TEST("net::ip::socket - UDP datagrams one at a time and in batches") {
+    using net::ip::address;
+    net::ip::socket a, b;
+    CHECK(not a.bind(address(127, 0, 0, 1, 0, net::ip::UDP)));
+    CHECK(not b.bind(address(127, 0, 0, 1, 0, net::ip::UDP)));
+    const address to_b(127, 0, 0, 1, b.port(), net::ip::UDP);
+
+    char block[2048];
+    address from;
+    CHECK(a.sendto(std::string("single"), to_b).size == 6);
+    net::ip::transfer tx = b.recvfrom({ block, net::ip::NO_FILL }, from);
+    CHECK(std::string_view(block, tx.size) == "single");
+    CHECK(from.port == a.port());
+
+    // each datagram keeps its own size and order
+    enum { COUNT = 8 };
+    std::string payloads[COUNT];
+    net::ip::datagram out[COUNT];
+    for (int i = 0; i < COUNT; ++i) {
+        payloads[i].assign(size_t(1 + i * 100), char('a' + i));
+        out[i].payload = payloads[i];
+        out[i].peer    = to_b;
+    }
+    CHECK(a.send_batch(out).size == COUNT);
+    char blocks[COUNT][1024];
+    net::ip::datagram in[COUNT];
+    size_t received = 0;
+    while (received < COUNT) {
+        for (size_t i = received; i < COUNT; ++i) {
+            in[i].buffer = { blocks[i], net::ip::NO_FILL };
+        }
+        tx = b.recv_batch(in + received, COUNT - received);
+        if (tx.error or tx.size == 0) break;
+        received += tx.size;
+    }
+    CHECK(received == COUNT);
+    for (int i = 0; i < COUNT; ++i) {
+        CHECK(std::string_view(blocks[i], in[i].size) == payloads[i]);
+        CHECK(in[i].peer.port == a.port());
+    }
+
+#if NET_PLATFORM_LINUX
+    // one GSO send of 350 bytes arrives as datagrams of 100, 100, 100 and 50
+    const std::string large(350, 'g');
+    net::ip::datagram segmented;
+    segmented.payload = large;
+    segmented.peer    = to_b;
+    segmented.segment = 100;
+    if (a.send_batch(&segmented, 1).size == 1) { // kernels since 4.18
+        size_t sizes = 0;
+        for (size_t expected : { 100, 100, 100, 50 }) {
+            tx = b.recvfrom({ block, net::ip::NO_FILL }, from);
+            sizes += (tx.size == expected);
+        }
+        CHECK(sizes == 4);
+    }
+#endif
+}
+
+
+TEST("net::http::response::write() - status line, headers, length, body") {
+    response r;
+    r.status = NOT_FOUND;
+    r.headers.set("X-A", "1");
+    r.content = "hello";
+    string pipelined;
+    r.write(pipelined);
+    r.headers.set("Content-Length", "5"); // kept, not repeated
+    r.write(pipelined);
+    CHECK(pipelined ==
+        "HTTP/1.1 404 Not Found\r\nX-A: 1\r\nContent-Length: 5\r\n\r\nhello"
+        "HTTP/1.1 404 Not Found\r\nContent-Length: 5\r\nX-A: 1\r\n\r\nhello");
+}
+
+
+TEST("net::http::server - stamps a current Date, unless the service did") {
+    server dated([](const request& q, response& r) {
+        r.status = OK;
+        if (q.uri == "/own") {
+            r.headers.set("Date", "Sun, 06 Nov 1994 08:49:37 GMT");
+        }
+    });
+    CHECK(not dated.start(0, THREADED));
+    const std::string address = "127.0.0.1:" + std::to_string(dated.port());
+    auto head = [&](const char* uri) {
+        net::ip::socket client;
+        client.connect(net::ip::address(net::ip::TCP, address.c_str()));
+        client.sendall("GET " + std::string(uri) + " HTTP/1.1\r\n\r\n");
+        char block[1024];
+        const net::ip::transfer tx = client.recv({ block, net::ip::NO_FILL });
+        return std::string(block, tx.error ? 0 : tx.size);
+    };
+
+    // IMF-fixdate, within a second of now
+    const std::string answer = head("/");
+    const size_t at = answer.find("\r\nDate: ");
+    CHECK(at != answer.npos);
+    const std::string date = answer.substr(at + 8, 29);
+    bool current = false;
+    const std::time_t now = std::time(nullptr);
+    for (std::time_t t = now - 1; t <= now + 1; ++t) {
+        char formatted[32];
+        std::strftime(formatted, sizeof(formatted),
+            "%a, %d %b %Y %H:%M:%S GMT", std::gmtime(&t));
+        current = current or date == formatted;
+    }
+    CHECK(current);
+
+    const std::string own = head("/own");
+    CHECK(own.find("\r\nDate: Sun, 06 Nov 1994 08:49:37 GMT\r\n") != own.npos);
+    CHECK(own.find("Date: ") == own.rfind("Date: ")); // only once
+    dated.stop();
+}
+
+
+TEST("net::http::config - admission limits connections and request rate") {
+    for (const engine e : { ENGINE_DEFAULT, THREADED }) {
+        config settings;
+        settings.engine          = e;
+        settings.max_connections = 2;
+        settings.request_rate    = 1; // a token a second, after the burst
+        settings.request_burst   = 5;
+        server limited([](const request&, response& r) { r.status = OK; });
+        CHECK(not limited.start(0, settings));
+        const std::string address =
+            "127.0.0.1:" + std::to_string(limited.port());
+        auto status = [](net::ip::socket& s) {
+            s.sendall(std::string("GET / HTTP/1.1\r\n\r\n"));
+            string input;
+            response r;
+            char block[1024];
+            net::ip::transfer tx;
+            while ((tx = s.recv({ block, net::ip::NO_FILL })) and tx.size) {
+                input.append(block, tx.size);
+                if (r.read(input)) return int(r.status);
+            }
+            return -1;
+        };
+
+        // a third concurrent connection from this address is turned away
+        std::vector<net::ip::socket> clients(3);
+        for (auto& c : clients) {
+            c.connect(net::ip::address(net::ip::TCP, address.c_str()));
+        }
+        CHECK(status(clients[0]) == OK and status(clients[1]) == OK);
+        CHECK(status(clients[2]) == SERVICE_UNAVAILABLE);
+
+        // the address's burst, two of it spent above, then 503s until a
+        // token accrues
+        int ok = 2, unavailable = 0;
+        for (int i = 0; i < 10; ++i) {
+            const int answer = status(clients[0]);
+            ok          += (answer == OK);
+            unavailable += (answer == SERVICE_UNAVAILABLE);
+        }
+        CHECK(ok >= 5 and ok <= 6);
+        CHECK(ok + unavailable == 12);
+        limited.stop();
+    }
+}
+
+
+TEST("net::http::tunnel - relays to a loopback echo, passing on EOF") {
+    for (const engine e : { ENGINE_DEFAULT, THREADED }) {
+        // echoes until the end of the stream, then says "bye" and closes
+        net::ip::socket echo;
+        CHECK(not echo.listen(net::ip::address(net::ip::TCP, "127.0.0.1:0")));
+        std::thread echoing([&echo] {
+            net::ip::socket c = echo.accept();
+            char block[4096];
+            net::ip::transfer tx;
+            while ((tx = c.recv({ block, net::ip::NO_FILL })) and tx.size) {
+                c.sendall({ block, tx.size });
+            }
+            c.sendall(std::string("bye"));
+        });
+
+        tunnel_ptr opened;
+        server front([](const request&, response& r) { r.status = OK; });
+        front.connect([&opened](const request&, const tunnel_ptr& t) {
+            opened = t;
+            return true;
+        });
+        CHECK(not front.start(0, e));
+        const std::string address =
+            "127.0.0.1:" + std::to_string(front.port());
+        net::ip::socket client;
+        CHECK(not client.connect(
+            net::ip::address(net::ip::TCP, address.c_str())));
+        const std::string target = "127.0.0.1:" + std::to_string(echo.port());
+        client.sendall("CONNECT " + target + " HTTP/1.1\r\n\r\nearly");
+
+        std::string payload(100000, 0);
+        for (size_t i = 0; i < payload.size(); ++i) payload[i] = char(i * 7);
+        std::thread writer([&] {
+            client.sendall(payload);
+            client.shutdown(net::ip::WRITE);
+        });
+        std::string answer;
+        char block[4096];
+        net::ip::transfer tx;
+        while ((tx = client.recv({ block, net::ip::NO_FILL })) and tx.size) {
+            answer.append(block, tx.size);
+        }
+        writer.join();
+        echoing.join();
+
+        const std::string head = "HTTP/1.1 200 Connection Established\r\n\r\n";
+        CHECK(answer.compare(0, head.size(), head) == 0);
+        CHECK(answer.substr(head.size()) == "early" + payload + "bye");
+        front.stop();
+        CHECK(opened and opened->target == target);
+        CHECK(opened->sent == payload.size() + 5);
+        CHECK(opened->received == payload.size() + 8);
+    }
+}
+
+
+TEST("net::http::websocket - a peer that never reads its pongs is closed") {
+    std::atomic<int> code { 0 };
+    server front([](const request&, response& r) { r.status = OK; });
+    front.upgrade([&code](const request&, const websocket_ptr& ws) {
+        ws->high_water = 4096;
+        ws->on_close = [&code](websocket&, uint16_t c) { code = c; };
+        return true;
+    });
+    CHECK(not front.start(0));
+    net::ip::socket client;
+    CHECK(not client.open(net::ip::TCP));
+    CHECK(not client.setsockopt(SOL_SOCKET, SO_RCVBUF, 4096));
+    const std::string address = "127.0.0.1:" + std::to_string(front.port());
+    CHECK(not client.connect(net::ip::address(net::ip::TCP, address.c_str())));
+    client.sendall(std::string(
+        "GET /ws HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n"));
+
+    // masked pings, with a zero mask, until the server gives up on us
+    std::string pings;
+    for (int i = 0; i < 100; ++i) {
+        pings += "\x89\xFD";
+        pings += std::string(4 + 125, 0);
+    }
+    for (int i = 0; i < 10000 and code == 0; ++i) {
+        if (not client.sendall(pings)) break;
+    }
+    for (int i = 0; i < 200 and code == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(code == 1008);
+    front.stop();
+}
+
+
+TEST("net::http::proxy - drops hop-by-hop headers both ways") {
+    server upstream([](const request& q, response& r) {
+        r.status = OK;
+        for (auto& pair : q.headers) {
+            r.content.append(pair.first).append("=");
+            r.content.append(pair.second).append("\n");
+        }
+        r.headers.set("Connection", "X-Hop");
+        r.headers.set("X-Hop", "1");
+        r.headers.set("X-End", "2");
+    });
+    CHECK(not upstream.start(0, THREADED));
+    proxy forwarder({ "127.0.0.1:" + std::to_string(upstream.port()) });
+    forwarder.health_interval_ms = 0;
+
+    const request q =
+        "GET /a HTTP/1.1\r\n"
+        "Connection: X-Drop\r\n"
+        "X-Drop: 1\r\n"
+        "Keep-Alive: timeout=5\r\n"
+        "X-Keep: 2\r\n"
+        "\r\n";
+    response r;
+    forwarder.forward(q, r);
+    CHECK(r.status == OK);
+    const std::string_view sent = r.content;
+    CHECK(sent.find("X-Keep=2\n") != sent.npos);
+    CHECK(sent.find("Via=1.1 net\n") != sent.npos);
+    CHECK(sent.find("X-Drop") == sent.npos);
+    CHECK(sent.find("Keep-Alive") == sent.npos);
+    CHECK(r.headers["X-End"] == "2" and r.headers["Via"] == "1.1 net");
+    CHECK(not r.headers.has("X-Hop") and not r.headers.has("Connection"));
+    upstream.stop();
+}
+
+
+TEST("net::http::proxy - reads unframed bodies to the end, refuses huge ones") {
+    net::ip::socket listener;
+    CHECK(not listener.open(net::ip::TCP));
+    CHECK(not listener.bind(uint16_t(0)) and not listener.listen());
+    std::thread upstream([&] {
+        for (const char* answer : {
+            "HTTP/1.1 200 OK\r\n\r\nuntil the end",
+            "HTTP/1.1 200 OK\r\nContent-Length: 99999999999\r\n\r\n",
+            "HTTP/1.1 200 OK\r\nContent-Length: 1x\r\n\r\nx" }) {
+            net::ip::socket s = listener.accept();
+            char request[4096];
+            s.recv({ request, net::ip::NO_FILL }); // in one piece, on loopback
+            s.sendall(std::string(answer));
+        }
+    });
+    proxy forwarder({ "127.0.0.1:" + std::to_string(listener.port()) });
+    forwarder.health_interval_ms = 0;
+    forwarder.max_content = 1 << 20;
+
+    const request q = "GET / HTTP/1.1\r\n\r\n";
+    response r;
+    forwarder.forward(q, r);
+    CHECK(r.status == OK and r.content == "until the end");
+    forwarder.forward(q, r);
+    CHECK(r.status == BAD_GATEWAY);
+    forwarder.forward(q, r);
+    CHECK(r.status == BAD_GATEWAY and forwarder.failed == 2);
+    upstream.join();
+}
+
+
+TEST("net::http::proxy - a hash key keeps its upstream") {
+    auto answer = [](const char* name) {
+        return [name](const request&, response& r) {
+            r.status  = OK;
+            r.content = name;
+        };
+    };
+    server a(answer("a")), b(answer("b"));
+    CHECK(not a.start(0, THREADED) and not b.start(0, THREADED));
+    proxy forwarder({
+        "127.0.0.1:" + std::to_string(a.port()),
+        "127.0.0.1:" + std::to_string(b.port()) });
+    forwarder.health_interval_ms = 0;
+    forwarder.balance  = proxy::CONSISTENT_HASH;
+    forwarder.hash_key = "X-User";
+
+    size_t to_a = 0;
+    for (int user = 0; user < 32; ++user) {
+        request q(GET, "/");
+        q.headers.set("X-User", std::to_string(user));
+        response first, second;
+        forwarder.forward(q, first);
+        forwarder.forward(q, second);
+        CHECK(first.status == OK and first.content == second.content);
+        to_a += (first.content == "a");
+    }
+    CHECK(to_a > 0 and to_a < 32);
+    a.stop();
+    b.stop();
+}
+
+
+TEST("net::http::access_log - writes each record, a tunnel's once answered") {
+    FILE* const file = std::tmpfile();
+    CHECK(file != nullptr);
+    uint64_t dropped = 0;
+    {
+        access_log log(fileno(file));
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&log] {
+                for (int i = 0; i < 100; ++i) {
+                    access_log::record r = {};
+                    r.status   = OK;
+                    r.method   = GET;
+                    r.uri_size = 2;
+                    memcpy(r.uri, "/x", 2);
+                    log.push(r);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        dropped = log.dropped; // only pushing drops
+
+        // a tunnel to a closed port answers 502, not 200
+        config settings;
+        settings.engine = THREADED;
+        settings.log    = &log;
+        server proxy([](const request&, response&) {});
+        proxy.connect([](const request&, const tunnel_ptr&) { return true; });
+        CHECK(not proxy.start(0, settings));
+        const std::string address =
+            "127.0.0.1:" + std::to_string(proxy.port());
+        net::ip::socket client;
+        CHECK(not client.connect(
+            net::ip::address(net::ip::TCP, address.c_str())));
+        client.sendall(std::string("CONNECT 127.0.0.1:1 HTTP/1.1\r\n\r\n"));
+        std::string answer;
+        char block[512];
+        net::ip::transfer tx;
+        while ((tx = client.recv({ block, net::ip::NO_FILL })) and tx.size) {
+            answer.append(block, tx.size);
+        }
+        CHECK(answer.find("HTTP/1.1 502") == 0);
+        proxy.stop();
+    } // written and stopped
+
+    std::string lines;
+    char block[4096];
+    std::rewind(file);
+    for (size_t n; (n = std::fread(block, 1, sizeof(block), file));) {
+        lines.append(block, n);
+    }
+    std::fclose(file);
+    CHECK(size_t(std::count(lines.begin(), lines.end(), '\n'))
+          == 400 - dropped + 1);
+    CHECK(lines.find(" method=GET uri=/x status=200 ") != lines.npos);
+    CHECK(lines.find(" method=CONNECT uri=127.0.0.1:1 status=502 ")
+          != lines.npos);
+}
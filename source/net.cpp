@@ -1,24 +1,38 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <climits>
+#include <cstdio>
 #include <cstring>
 #include <chrono>
+#include <ctime>
+#include <deque>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <mutex>
 #include <thread>
+#include <vector>
 #include <errno.h>
 #include <net/ip.h>
 #include <net/http.h>
 #include "substr.h"
+#include "uring.h"
 
 
 #if NET_COMPILER_MSVC
 
     #include <WinSock2.h>
     #include <WS2tcpip.h>
+    #include <afunix.h>
     #undef DELETE
     #undef min
     #undef max
     inline int close(int socket) { return closesocket(socket); }
+    inline int poll(pollfd* fds, ULONG count, int timeout) {
+        return WSAPoll(fds, count, timeout);
+    }
 
     #define NET_SOCKET_SYSTEM_INITIALIZATION \
         static struct NET_SOCKET_SYSTEM_INITIALIZATION { \
@@ -39,9 +53,15 @@
 
     #include <arpa/inet.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <sys/socket.h>
+    #include <sys/stat.h>
     #include <sys/time.h>
+    #include <sys/un.h>
+    #include <fcntl.h>
     #include <netdb.h>
+    #include <poll.h>
+    #include <signal.h>
     #include <unistd.h>
 
     #define NET_SOCKET_SYSTEM_INITIALIZATION ((void)0)
@@ -49,6 +69,20 @@
 #endif
 
 
+#if NET_PLATFORM_LINUX
+
+    #include <linux/mempolicy.h>
+    #include <netinet/udp.h>
+    #include <sched.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <sys/mman.h>
+    #include <sys/sendfile.h>
+    #include <sys/syscall.h>
+
+#endif
+
+
 //==============================================================================
 
 
@@ -93,6 +127,11 @@ namespace ip {
     }
 
 
+    std::ostream& operator<<(std::ostream& out, const ip::path& p) {
+        return out << p.name << " (LOCAL)";
+    }
+
+
     struct host {
         char addr[120] {};
         char port[8] = "http";
@@ -111,7 +150,8 @@ namespace ip {
             }
             if (url.seek(':')) {
                 substr portnum = url.after(':');
-                const size_t count = std::min(sizeof(port), portnum.length());
+                const size_t count = std::min(sizeof(port)-1, portnum.length());
+                memset(port, 0, sizeof(port));
                 strncpy(port, portnum.begin(), count);
                 url = url.before(':');
             }
@@ -208,13 +248,327 @@ namespace ip {
     target::clear() { memset(head, 0, size); }
 
 
+    // placement ===============================================================
+
+
+    namespace {
+
+        // the calling thread's NUMA node, looked up on first use and again
+        // after the thread is pinned
+        thread_local int thread_node = -1;
+
+        unsigned local_node() {
+        #if NET_PLATFORM_LINUX
+            if (thread_node < 0) {
+                unsigned cpu = 0, node = 0;
+                const long found = syscall(SYS_getcpu, &cpu, &node, nullptr);
+                thread_node = (found == 0) ? int(node) : 0;
+            }
+            return unsigned(thread_node);
+        #else
+            return 0;
+        #endif
+        }
+
+        // runs the calling thread on `cpu` alone; false if it cannot
+        bool pin_thread(int cpu) {
+        #if NET_PLATFORM_LINUX
+            if (cpu < 0 or cpu >= CPU_SETSIZE) return false;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            if (sched_setaffinity(0, sizeof(set), &set) != 0) return false;
+            thread_node = -1;
+            return true;
+        #else
+            (void)cpu; return false;
+        #endif
+        }
+
+        // prefers `node` for the untouched, page aligned pages at `data`
+        void bind_to_node(void* data, size_t size, unsigned node) {
+        #if NET_PLATFORM_LINUX
+            enum : unsigned { BITS = 8 * sizeof(unsigned long) };
+            unsigned long mask[256 / BITS] = {};
+            if (node >= 256) return;
+            mask[node / BITS] = 1ul << (node % BITS);
+            syscall(SYS_mbind, data, size, MPOL_PREFERRED, mask, 256, 0);
+        #else
+            (void)data; (void)size; (void)node;
+        #endif
+        }
+
+    } // namespace
+
+
+    // index stack =============================================================
+
+
+    /*--------------------------------------------------------------------------
+    A lock-free stack of indices, linked through `links.next_of(index)`,
+    which holds the index below plus one, or 0.  The head packs a generation
+    count above the top index so that a pop racing with a pop and push of the
+    same index fails its compare-exchange instead of corrupting the stack.
+    --------------------------------------------------------------------------*/
+    namespace {
+
+        class index_stack {
+
+            std::atomic<uint64_t> head { 0 }; // generation:32 | top index + 1
+
+        public:
+
+            template<typename Links>
+            bool pop(uint32_t& index, const Links& links) {
+                uint64_t h = head.load(std::memory_order_acquire);
+                for (;;) {
+                    const uint32_t top = uint32_t(h);
+                    if (top == 0) return false;
+                    const uint32_t next =
+                        links.next_of(top - 1).load(std::memory_order_relaxed);
+                    const uint64_t popped = ((h >> 32) + 1) << 32 | next;
+                    if (head.compare_exchange_weak(
+                            h, popped,
+                            std::memory_order_acquire,
+                            std::memory_order_acquire)) {
+                        index = top - 1;
+                        return true;
+                    }
+                }
+            }
+
+            template<typename Links>
+            void push(uint32_t index, const Links& links) {
+                uint64_t h = head.load(std::memory_order_relaxed);
+                uint64_t pushed;
+                do {
+                    links.next_of(index).store(
+                        uint32_t(h), std::memory_order_relaxed);
+                    pushed = ((h >> 32) + 1) << 32 | (index + 1);
+                } while (not head.compare_exchange_weak(
+                            h, pushed,
+                            std::memory_order_release,
+                            std::memory_order_relaxed));
+            }
+        };
+
+    } // namespace
+
+
+    // buffer ==================================================================
+
+
+    /*--------------------------------------------------------------------------
+    Buffers are carved from slabs that are never freed, and the free buffers
+    form an index_stack.
+
+    There is a pool per NUMA node, whose slabs prefer that node's memory; a
+    buffer's slot holds its node above its index, so that it is returned to
+    the pool it came from whichever thread releases it.
+    --------------------------------------------------------------------------*/
+    namespace {
+
+        class buffer_pool {
+
+            enum : uint32_t { SLAB = 64, SLABS = 4096 }; // up to 4 GiB
+
+            struct slab {
+                std::atomic<uint32_t> next[SLAB]; // index + 1 below, or 0
+                alignas(64) char      data[SLAB][buffer::SIZE];
+            };
+
+            const unsigned        node;
+            index_stack           free;
+            std::atomic<slab*>    slabs[SLABS] {};
+            std::atomic<uint32_t> slab_count { 0 };
+            std::mutex            grow_mutex;
+
+            slab* allocate() const {
+            #if NET_PLATFORM_LINUX
+                void* const memory = mmap(
+                    nullptr, sizeof(slab), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (memory == MAP_FAILED) return nullptr;
+                bind_to_node(memory, sizeof(slab), node);
+                return new(memory) slab;
+            #else
+                return new(std::nothrow) slab;
+            #endif
+            }
+
+            slab& slab_of(uint32_t index) const {
+                return *slabs[index / SLAB].load(std::memory_order_acquire);
+            }
+
+            std::atomic<uint32_t>& next_of(uint32_t index) const {
+                return slab_of(index).next[index % SLAB];
+            }
+
+            friend class index_stack;
+
+            bool pop(uint32_t& index) { return free.pop(index, *this); }
+
+            bool grow(uint32_t& index) {
+                std::lock_guard<std::mutex> lock(grow_mutex);
+                if (pop(index)) return true; // another thread grew the pool
+                const uint32_t count = slab_count.load();
+                if (count == SLABS) return false;
+                slab* const s = allocate();
+                if (not s) return false;
+                slabs[count].store(s, std::memory_order_release);
+                slab_count.store(count + 1, std::memory_order_release);
+                for (uint32_t i = 1; i < SLAB; ++i) push(count * SLAB + i);
+                index = count * SLAB;
+                return true;
+            }
+
+        public:
+
+            enum : uint32_t { NODES = 64, NODE_SHIFT = 24 };
+
+            explicit buffer_pool(unsigned node) : node(node) {}
+
+            // the pool of `node`, created on first use and never destroyed,
+            // as buffers may be returned during exit
+            static buffer_pool* of(unsigned node, bool create = true) {
+                static std::atomic<buffer_pool*> pools[NODES] {};
+                std::atomic<buffer_pool*>& slot = pools[node % NODES];
+                buffer_pool* pool = slot.load(std::memory_order_acquire);
+                if (pool or not create) return pool;
+                buffer_pool* const created = new buffer_pool(node % NODES);
+                if (slot.compare_exchange_strong(pool, created)) {
+                    return created;
+                }
+                delete created; // another thread created it first
+                return pool;
+            }
+
+            static buffer_pool& local() { return *of(local_node()); }
+
+            unsigned id() const { return node; }
+
+            char* data(uint32_t index) const {
+                return slab_of(index).data[index % SLAB];
+            }
+
+            bool borrow(uint32_t& index) { return pop(index) or grow(index); }
+
+            void push(uint32_t index) { free.push(index, *this); }
+
+            size_t size() const { return size_t(slab_count.load()) * SLAB; }
+        };
+
+    } // namespace
+
+
+    buffer
+    buffer::borrow() {
+        buffer_pool& pool = buffer_pool::local();
+        uint32_t index;
+        if (not pool.borrow(index)) return buffer();
+        const uint32_t slot = pool.id() << buffer_pool::NODE_SHIFT | index;
+        return buffer(pool.data(index), slot);
+    }
+
+
+    void
+    buffer::release(uint32_t slot) {
+        const uint32_t index = slot & ((1u << buffer_pool::NODE_SHIFT) - 1);
+        buffer_pool::of(slot >> buffer_pool::NODE_SHIFT)->push(index);
+    }
+
+
+    size_t
+    buffer::pooled() {
+        size_t size = 0;
+        for (unsigned node = 0; node < buffer_pool::NODES; ++node) {
+            if (buffer_pool* pool = buffer_pool::of(node, false)) {
+                size += pool->size();
+            }
+        }
+        return size;
+    }
+
+
     // socket ==================================================================
 
 
+    static
+    sockaddr_in
+    to_sockaddr(ip::address address) {
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family      = AF_INET;
+        sa.sin_port        = htons(address.port);
+        sa.sin_addr.s_addr = htonl(address.host);
+        return sa;
+    }
+
+
+    static
+    ip::address
+    from_sockaddr(const sockaddr_in& sa, ip::protocol protocol) {
+        ip::address address;
+        address.host     = ntohl(sa.sin_addr.s_addr);
+        address.port     = ntohs(sa.sin_port);
+        address.protocol = protocol;
+        return address;
+    }
+
+
+    // false if the name does not fit
+    static
+    bool
+    to_sockaddr(const ip::path& path, sockaddr_un& sa, socklen_t& size) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        const size_t length = strlen(path.name);
+        if (length >= sizeof(sa.sun_path)) return false;
+        memcpy(sa.sun_path, path.name, length);
+        size = socklen_t(offsetof(sockaddr_un, sun_path) + length + 1);
+    #if NET_PLATFORM_LINUX
+        if (path.abstract()) {
+            sa.sun_path[0] = '\0'; // and the name is not terminated
+            size -= 1;
+        }
+    #endif
+        return true;
+    }
+
+
+    static
+    ip::path
+    from_sockaddr(const sockaddr_un& sa, socklen_t size) {
+        ip::path path;
+        const size_t offset = offsetof(sockaddr_un, sun_path);
+        if (sa.sun_family != AF_UNIX or size <= offset) return path;
+        const size_t length = std::min<size_t>(
+            size - offset, sizeof(path.name) - 1);
+        memcpy(path.name, sa.sun_path, length);
+        if (length and path.name[0] == '\0') path.name[0] = '@';
+        return path;
+    }
+
+
     address
     socket::address() const {
         sockaddr_in a; socklen_t size = sizeof(a);
-        if (ok(getsockname(id, (sockaddr*)&a, &size))) {
+        if (ok(getsockname(id, (sockaddr*)&a, &size)) and
+            a.sin_family == AF_INET) {
+            ip::address address;
+            address.host = ntohl(a.sin_addr.s_addr);
+            address.port = ntohs(a.sin_port);
+            return address;
+        }
+        return {};
+    }
+
+
+    ip::address
+    socket::peer() const {
+        sockaddr_in a; socklen_t size = sizeof(a);
+        if (ok(getpeername(id, (sockaddr*)&a, &size)) and
+            a.sin_family == AF_INET) {
             ip::address address;
             address.host = ntohl(a.sin_addr.s_addr);
             address.port = ntohs(a.sin_port);
@@ -224,6 +578,16 @@ namespace ip {
     }
 
 
+    ip::path
+    socket::path() const {
+        sockaddr_un a; socklen_t size = sizeof(a);
+        if (ok(getsockname(id, (sockaddr*)&a, &size))) {
+            return from_sockaddr(a, size);
+        }
+        return {};
+    }
+
+
     socket
     socket::accept() const {
         sockaddr_in a; socklen_t size = sizeof(a);
@@ -250,17 +614,39 @@ namespace ip {
     }
 
 
+    error
+    socket::bind(const ip::path& path) {
+        if (not ok()) {
+            if (auto err = open(TCP, LOCAL)) {
+                return err;
+            }
+        }
+        sockaddr_un sa; socklen_t size;
+        if (not to_sockaddr(path, sa, size)) return error(ENAMETOOLONG);
+        return
+            ok(::bind(id, (sockaddr*)&sa, size))
+            ? error::none()
+            : error();
+    }
+
+
     error
     socket::close() {
-        const int old_id = id;
-        new(this)socket();
         return
-            ok(::close(old_id))
+            ok(::close(release()))
             ? error::none()
             : error();
     }
 
 
+    int
+    socket::release() {
+        const int old_id = id;
+        new(this)socket();
+        return old_id;
+    }
+
+
     error
     socket::connect(ip::address address) {
         if (not ok()) {
@@ -280,6 +666,22 @@ namespace ip {
     }
 
 
+    error
+    socket::connect(const ip::path& path) {
+        if (not ok()) {
+            if (auto err = open(TCP, LOCAL)) {
+                return err;
+            }
+        }
+        sockaddr_un sa; socklen_t size;
+        if (not to_sockaddr(path, sa, size)) return error(ENAMETOOLONG);
+        return
+            ok(::connect(id, (sockaddr*)&sa, size))
+            ? error::none()
+            : error();
+    }
+
+
     error
     socket::listen(int backlog) {
         return
@@ -298,6 +700,15 @@ namespace ip {
     }
 
 
+    error
+    socket::listen(const ip::path& path, int backlog) {
+        if (ok()) close();
+        if (auto err = open(TCP, LOCAL)) return err;
+        if (auto err = bind(path)) return err;
+        return listen(backlog);
+    }
+
+
     #ifndef MSG_NOSIGNAL
         enum { MSG_NOSIGNAL = 0 };
     #endif
@@ -308,14 +719,30 @@ namespace ip {
     #endif
 
 
+    #ifdef MSG_DONTWAIT
+        enum { DONTWAIT = MSG_DONTWAIT };
+    #else
+        enum { DONTWAIT = 0 }; // sockets are made non-blocking instead
+    #endif
+
+
+    static
+    bool
+    would_block() {
+        return errno == EAGAIN or errno == EWOULDBLOCK or errno == EINPROGRESS;
+    }
+
+
     error
-    socket::open(protocol p) {
+    socket::open(protocol p, family f) {
         NET_SOCKET_SYSTEM_INITIALIZATION;
         if (id > INVALID) close();
         const int ipproto =
+            (f == LOCAL)       ? 0 :
             (p == SOCK_STREAM) ? IPPROTO_TCP :
             (p == SOCK_DGRAM)  ? IPPROTO_UDP : 0;
-        const int new_id = ::socket(AF_INET, p, ipproto);
+        const int new_id =
+            ::socket((f == LOCAL) ? AF_UNIX : AF_INET, p, ipproto);
         new(this)socket(new_id);
         if (not ok()) return error();
         return setsockopt(SOL_SOCKET, SO_NOSIGPIPE, true);
@@ -366,6 +793,224 @@ namespace ip {
     }
 
 
+    transfer
+    socket::recvfrom(target data, ip::address& from) const {
+        char* const head = (char*)data.head;
+        int   const size = int(data.size);
+        sockaddr_in sa; socklen_t sa_size = sizeof(sa);
+        const int rcvd = int(::recvfrom(
+            id, head, size, MSG_NOSIGNAL, (sockaddr*)&sa, &sa_size));
+        if (rcvd < 0) return transfer(error());
+        from = from_sockaddr(sa, UDP);
+        return transfer(size_t(rcvd));
+    }
+
+
+    transfer
+    socket::sendto(source data, ip::address to) const {
+        const char* head = (const char*)data.head;
+        const int   size = int(data.size);
+        const sockaddr_in sa = to_sockaddr(to);
+        const int sent = int(::sendto(
+            id, head, size, MSG_NOSIGNAL, (const sockaddr*)&sa, sizeof(sa)));
+        return (sent >= 0) ? transfer(size_t(sent)) : transfer(error());
+    }
+
+
+    transfer
+    socket::recvfrom(target data, ip::path& from) const {
+        char* const head = (char*)data.head;
+        int   const size = int(data.size);
+        sockaddr_un sa; socklen_t sa_size = sizeof(sa);
+        const int rcvd = int(::recvfrom(
+            id, head, size, MSG_NOSIGNAL, (sockaddr*)&sa, &sa_size));
+        if (rcvd < 0) return transfer(error());
+        from = from_sockaddr(sa, sa_size);
+        return transfer(size_t(rcvd));
+    }
+
+
+    transfer
+    socket::sendto(source data, const ip::path& to) const {
+        const char* head = (const char*)data.head;
+        const int   size = int(data.size);
+        sockaddr_un sa; socklen_t sa_size;
+        if (not to_sockaddr(to, sa, sa_size)) {
+            return transfer(error(ENAMETOOLONG));
+        }
+        const int sent = int(::sendto(
+            id, head, size, MSG_NOSIGNAL, (const sockaddr*)&sa, sa_size));
+        return (sent >= 0) ? transfer(size_t(sent)) : transfer(error());
+    }
+
+
+#if NET_PLATFORM_LINUX
+
+
+    enum { BATCH = 64 }; // datagrams per recvmmsg()/sendmmsg()
+
+
+    transfer
+    socket::recv_batch(datagram* batch, size_t count) const {
+        mmsghdr     msgs[BATCH];
+        iovec       iovs[BATCH];
+        sockaddr_in addrs[BATCH];
+        union { cmsghdr align; char bytes[CMSG_SPACE(sizeof(int))]; }
+                    controls[BATCH];
+
+        size_t received = 0;
+        while (received < count) {
+            datagram* const d = batch + received;
+            const size_t    remaining = count - received;
+            const unsigned  n = unsigned(std::min<size_t>(remaining, BATCH));
+            for (unsigned i = 0; i < n; ++i) {
+                iovs[i].iov_base = d[i].buffer.head;
+                iovs[i].iov_len  = d[i].buffer.size;
+                msghdr& m = msgs[i].msg_hdr;
+                m.msg_name       = &addrs[i];
+                m.msg_namelen    = sizeof(addrs[i]);
+                m.msg_iov        = &iovs[i];
+                m.msg_iovlen     = 1;
+                m.msg_control    = controls[i].bytes;
+                m.msg_controllen = sizeof(controls[i].bytes);
+                m.msg_flags      = 0;
+            }
+            // block for the first datagram only
+            const int flags = received ? MSG_DONTWAIT : MSG_WAITFORONE;
+            const int r = recvmmsg(id, msgs, n, flags, nullptr);
+            if (r < 0) {
+                if (received and would_block()) break;
+                return { received, error() };
+            }
+            for (int i = 0; i < r; ++i) {
+                msghdr& m = msgs[i].msg_hdr;
+                d[i].size    = msgs[i].msg_len;
+                d[i].peer    = from_sockaddr(addrs[i], UDP);
+                d[i].segment = 0;
+                cmsghdr* c = CMSG_FIRSTHDR(&m);
+                for (; c; c = CMSG_NXTHDR(&m, c)) {
+                    if (c->cmsg_level == SOL_UDP and c->cmsg_type == UDP_GRO) {
+                        int segment = 0;
+                        memcpy(&segment, CMSG_DATA(c), sizeof(segment));
+                        d[i].segment = uint16_t(segment);
+                    }
+                }
+            }
+            received += size_t(r);
+            if (unsigned(r) < n) break;
+        }
+        return transfer(received);
+    }
+
+
+    transfer
+    socket::send_batch(datagram* batch, size_t count) const {
+        mmsghdr     msgs[BATCH];
+        iovec       iovs[BATCH];
+        sockaddr_in addrs[BATCH];
+        union { cmsghdr align; char bytes[CMSG_SPACE(sizeof(uint16_t))]; }
+                    controls[BATCH];
+
+        size_t sent = 0;
+        while (sent < count) {
+            datagram* const d = batch + sent;
+            const size_t    remaining = count - sent;
+            const unsigned  n = unsigned(std::min<size_t>(remaining, BATCH));
+            for (unsigned i = 0; i < n; ++i) {
+                addrs[i] = to_sockaddr(d[i].peer);
+                iovs[i].iov_base = (void*)d[i].payload.head;
+                iovs[i].iov_len  = d[i].payload.size;
+                msghdr& m = msgs[i].msg_hdr;
+                m.msg_name       = d[i].peer ? &addrs[i] : nullptr;
+                m.msg_namelen    = d[i].peer ? sizeof(addrs[i]) : 0;
+                m.msg_iov        = &iovs[i];
+                m.msg_iovlen     = 1;
+                m.msg_control    = nullptr;
+                m.msg_controllen = 0;
+                m.msg_flags      = 0;
+                if (d[i].segment) {
+                    // kernel splits the payload into `segment` sized datagrams
+                    m.msg_control    = controls[i].bytes;
+                    m.msg_controllen = sizeof(controls[i].bytes);
+                    cmsghdr* const c = CMSG_FIRSTHDR(&m);
+                    c->cmsg_level = SOL_UDP;
+                    c->cmsg_type  = UDP_SEGMENT;
+                    c->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+                    memcpy(CMSG_DATA(c), &d[i].segment, sizeof(uint16_t));
+                }
+            }
+            const int r = sendmmsg(id, msgs, n, MSG_NOSIGNAL);
+            if (r < 0) return { sent, error() };
+            sent += size_t(r);
+        }
+        return transfer(sent);
+    }
+
+
+    error
+    socket::gro(bool enable) {
+        return setsockopt(SOL_UDP, UDP_GRO, enable);
+    }
+
+
+    error
+    socket::gso(uint16_t size) {
+        return setsockopt(SOL_UDP, UDP_SEGMENT, int(size));
+    }
+
+
+#else // one datagram per system call
+
+
+    transfer
+    socket::recv_batch(datagram* batch, size_t count) const {
+        size_t received = 0;
+        for (; received < count; ++received) {
+            datagram& d = batch[received];
+            if (received and DONTWAIT == 0) break; // would block
+            char* const head = (char*)d.buffer.head;
+            int   const size = int(d.buffer.size);
+            const int   flags = int(MSG_NOSIGNAL) | (received ? DONTWAIT : 0);
+            sockaddr_in sa; socklen_t sa_size = sizeof(sa);
+            const int rcvd = int(::recvfrom(
+                id, head, size, flags, (sockaddr*)&sa, &sa_size));
+            if (rcvd < 0) {
+                if (received and would_block()) break;
+                return { received, error() };
+            }
+            d.size    = size_t(rcvd);
+            d.peer    = from_sockaddr(sa, UDP);
+            d.segment = 0;
+        }
+        return transfer(received);
+    }
+
+
+    transfer
+    socket::send_batch(datagram* batch, size_t count) const {
+        size_t sent = 0;
+        for (; sent < count; ++sent) {
+            datagram& d = batch[sent];
+            if (d.segment) return { sent, error(ENOTSUP) };
+            const transfer tx =
+                d.peer ? sendto(d.payload, d.peer) : send(d.payload);
+            if (tx.error) return { sent, tx.error };
+        }
+        return transfer(sent);
+    }
+
+
+    error
+    socket::gro(bool) { return error(ENOTSUP); }
+
+
+    error
+    socket::gso(uint16_t) { return error(ENOTSUP); }
+
+
+#endif // NET_PLATFORM_LINUX
+
+
     error
     socket::shutdown(operation o) {
         return
@@ -403,23 +1048,516 @@ namespace ip {
     }
 
 
-}} // namespace net::ip
+    // tuning ------------------------------------------------------------------
 
 
-//==============================================================================
+    error
+    socket::nodelay(bool enable) {
+        return setsockopt(IPPROTO_TCP, TCP_NODELAY, enable);
+    }
 
 
-namespace net {
-namespace http {
+    error
+    socket::quickack(bool enable) {
+    #ifdef TCP_QUICKACK
+        return setsockopt(IPPROTO_TCP, TCP_QUICKACK, enable);
+    #else
+        (void)enable; return error(ENOPROTOOPT);
+    #endif
+    }
 
 
-    // method ==================================================================
+    error
+    socket::defer_accept(int secs) {
+    #ifdef TCP_DEFER_ACCEPT
+        return setsockopt(IPPROTO_TCP, TCP_DEFER_ACCEPT, secs);
+    #else
+        (void)secs; return error(ENOPROTOOPT);
+    #endif
+    }
 
 
-    const char*
-    method_to_string(http::method m) {
-        switch (m) {
-            default:      return "UNKNOWN";
+    error
+    socket::fastopen(int queue) {
+    #ifdef TCP_FASTOPEN
+        return setsockopt(IPPROTO_TCP, TCP_FASTOPEN, queue);
+    #else
+        (void)queue; return error(ENOPROTOOPT);
+    #endif
+    }
+
+
+    error
+    socket::fastopen_connect(bool enable) {
+    #ifdef TCP_FASTOPEN_CONNECT
+        return setsockopt(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, enable);
+    #else
+        (void)enable; return error(ENOPROTOOPT);
+    #endif
+    }
+
+
+    error
+    socket::recv_buffer(int bytes) {
+        return setsockopt(SOL_SOCKET, SO_RCVBUF, bytes);
+    }
+
+
+    error
+    socket::send_buffer(int bytes) {
+        return setsockopt(SOL_SOCKET, SO_SNDBUF, bytes);
+    }
+
+
+    error
+    socket::busy_poll(int usecs) {
+    #ifdef SO_BUSY_POLL
+        return setsockopt(SOL_SOCKET, SO_BUSY_POLL, usecs);
+    #else
+        (void)usecs; return error(ENOPROTOOPT);
+    #endif
+    }
+
+
+    error
+    socket::reuse_port(bool enable) {
+    #ifdef SO_REUSEPORT
+        return setsockopt(SOL_SOCKET, SO_REUSEPORT, enable);
+    #else
+        (void)enable; return error(ENOPROTOOPT);
+    #endif
+    }
+
+
+    error
+    socket::incoming_cpu(int cpu) {
+    #ifdef SO_INCOMING_CPU
+        return setsockopt(SOL_SOCKET, SO_INCOMING_CPU, cpu);
+    #else
+        (void)cpu; return error(ENOPROTOOPT);
+    #endif
+    }
+
+
+    error
+    socket::timeout(int ms) {
+    #if NET_COMPILER_MSVC
+        const DWORD value = DWORD(ms);
+    #else
+        timeval value;
+        value.tv_sec  = ms / 1000;
+        value.tv_usec = (ms % 1000) * 1000;
+    #endif
+        if (auto err = setsockopt(SOL_SOCKET, SO_RCVTIMEO, source(value))) {
+            return err;
+        }
+        return setsockopt(SOL_SOCKET, SO_SNDTIMEO, source(value));
+    }
+
+
+    int
+    socket::incoming_cpu() const {
+    #ifdef SO_INCOMING_CPU
+        int cpu = -1; socklen_t size = sizeof(cpu);
+        if (::getsockopt(id, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &size) == 0) {
+            return cpu;
+        }
+    #endif
+        return -1;
+    }
+
+
+    static
+    error
+    set_nonblocking(int id, bool enable) {
+    #if NET_COMPILER_MSVC
+        u_long mode = enable ? 1 : 0;
+        return
+            ok(ioctlsocket(id, FIONBIO, &mode))
+            ? error::none()
+            : error();
+    #else
+        const int flags = fcntl(id, F_GETFL, 0);
+        if (flags == -1) return error();
+        const int new_flags =
+            enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+        if (new_flags == flags) return error::none();
+        return
+            (fcntl(id, F_SETFL, new_flags) != -1)
+            ? error::none()
+            : error();
+    #endif
+    }
+
+
+    error
+    socket::nonblocking(bool enable) {
+        return set_nonblocking(id, enable);
+    }
+
+
+    // reactor =================================================================
+
+
+    // returns true once `op` has completed, successfully or not
+    static
+    bool
+    attempt_once(reactor::operation& op) {
+        using operation = reactor::operation;
+
+        if (op.error) return true;
+
+        if (not op.started) {
+            op.started = true;
+            const bool needs_nonblocking =
+                (op.type == operation::ACCEPT) or
+                (op.type == operation::CONNECT) or
+                (DONTWAIT == 0);
+            if (needs_nonblocking) {
+                if (auto err = set_nonblocking(op.socket, true)) {
+                    op.error = err;
+                    return true;
+                }
+            }
+            if (op.type == operation::CONNECT) {
+                const sockaddr_in sa = to_sockaddr(op.address);
+                if (::connect(op.socket, (sockaddr*)&sa, sizeof(sa)) == 0) {
+                    return true;
+                }
+                if (would_block()) return false;
+                op.error = error();
+                return true;
+            }
+        }
+
+        const int flags = int(MSG_NOSIGNAL) | int(DONTWAIT);
+        switch (op.type) {
+            case operation::ACCEPT: {
+                const int id = int(::accept(op.socket, nullptr, nullptr));
+                if (socket::ok(id)) { op.accepted = id; return true; }
+                break;
+            }
+            case operation::CONNECT: {
+                // the socket became writable, so the connection has resolved
+                int err = 0; socklen_t size = sizeof(err);
+                getsockopt(op.socket, SOL_SOCKET, SO_ERROR, (char*)&err, &size);
+                op.error = error(err);
+                return true;
+            }
+            case operation::RECV: {
+                char* const head = (char*)op.target.head;
+                const int   size = int(op.target.size);
+                const int r = int(::recv(op.socket, head, size, flags));
+                if (r >= 0) { op.size = size_t(r); return true; }
+                break;
+            }
+            case operation::SEND: {
+                const char* head = (const char*)op.source.head;
+                const int   size = int(op.source.size);
+                const int r = int(::send(op.socket, head, size, flags));
+                if (r >= 0) { op.size = size_t(r); return true; }
+                break;
+            }
+            case operation::SENDALL: {
+                while (op.source) {
+                    const char* head = (const char*)op.source.head;
+                    const int size = int(op.source.size);
+                    const int r = int(::send(op.socket, head, size, flags));
+                    if (r < 0) break;
+                    op.size += size_t(r);
+                    op.source.advance(size_t(r));
+                }
+                if (not op.source) return true;
+                break;
+            }
+        }
+        if (would_block()) return false;
+        op.error = error();
+        return true;
+    }
+
+
+    // as attempt_once(), leaving a listening or connecting socket blocking
+    // again once its operation has completed
+    static
+    bool
+    attempt(reactor::operation& op) {
+        using operation = reactor::operation;
+        if (not attempt_once(op)) return false;
+        const bool switched =
+            (op.type == operation::ACCEPT) or
+            (op.type == operation::CONNECT);
+        if (switched and op.started) set_nonblocking(op.socket, false);
+        return true;
+    }
+
+
+    static
+    bool
+    is_write(const reactor::operation& op) {
+        using operation = reactor::operation;
+        return
+            op.type == operation::CONNECT or
+            op.type == operation::SEND or
+            op.type == operation::SENDALL;
+    }
+
+
+#if NET_PLATFORM_LINUX
+
+
+    struct reactor::state {
+
+        struct watch {
+            operation* reader = nullptr;
+            operation* writer = nullptr;
+        };
+
+        int                 poller = -1;
+        int                 wakeup = -1;
+        std::mutex          mutex;
+        std::vector<watch>  watches; // indexed by socket id
+        std::atomic<size_t> pending  { 0 };
+        std::atomic<bool>   stopping { false };
+
+        // (re)registers the remaining interest in a one-shot readiness event
+        void arm(int id, const watch& w) {
+            epoll_event e;
+            e.events =
+                uint32_t(EPOLLONESHOT) |
+                (w.reader ? uint32_t(EPOLLIN | EPOLLRDHUP) : 0u) |
+                (w.writer ? uint32_t(EPOLLOUT) : 0u);
+            e.data.fd = id;
+            if (not (w.reader or w.writer)) return;
+            if (epoll_ctl(poller, EPOLL_CTL_MOD, id, &e) == 0) return;
+            if (errno == ENOENT) epoll_ctl(poller, EPOLL_CTL_ADD, id, &e);
+        }
+
+        void wait(operation& op) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (size_t(op.socket) >= watches.size()) {
+                watches.resize(size_t(op.socket) + 1);
+            }
+            watch& w = watches[op.socket];
+            operation*& slot = is_write(op) ? w.writer : w.reader;
+            assert(not slot); // one reader and one writer per socket
+            slot = &op;
+            arm(op.socket, w);
+        }
+
+        bool cancel(operation& op) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (size_t(op.socket) >= watches.size()) return false;
+            watch& w = watches[op.socket];
+            operation*& slot = is_write(op) ? w.writer : w.reader;
+            if (slot != &op) return false;
+            slot = nullptr;
+            arm(op.socket, w);
+            return true;
+        }
+    };
+
+
+    reactor::reactor()
+    : _state(new state) {
+        _state->poller = epoll_create1(EPOLL_CLOEXEC);
+        _state->wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        epoll_event e;
+        e.events  = EPOLLIN;
+        e.data.fd = _state->wakeup;
+        epoll_ctl(_state->poller, EPOLL_CTL_ADD, _state->wakeup, &e);
+    }
+
+
+    reactor::~reactor() {
+        ::close(_state->wakeup);
+        ::close(_state->poller);
+        delete _state;
+    }
+
+
+    size_t
+    reactor::poll(int timeout_ms) {
+        if (_state->stopping) return 0;
+
+        epoll_event events[64];
+        const int count =
+            epoll_wait(_state->poller, events, 64, timeout_ms);
+
+        size_t completed = 0;
+        for (int i = 0; i < count; ++i) {
+            const int      id = events[i].data.fd;
+            const uint32_t e  = events[i].events;
+            if (id == _state->wakeup) continue;
+
+            operation* ready[2] = {};
+            {
+                std::lock_guard<std::mutex> lock(_state->mutex);
+                state::watch& w = _state->watches[id];
+                if (w.reader and (e & (EPOLLIN|EPOLLRDHUP|EPOLLERR|EPOLLHUP))) {
+                    ready[0] = w.reader; w.reader = nullptr;
+                }
+                if (w.writer and (e & (EPOLLOUT|EPOLLERR|EPOLLHUP))) {
+                    ready[1] = w.writer; w.writer = nullptr;
+                }
+                _state->arm(id, w);
+            }
+
+            for (operation* op : ready) {
+                if (not op) continue;
+                if (attempt(*op)) {
+                    _state->pending -= 1;
+                    completed += 1;
+                    op->resume(op->context);
+                }
+                else {
+                    _state->wait(*op);
+                }
+            }
+        }
+        return completed;
+    }
+
+
+    void
+    reactor::stop() {
+        _state->stopping = true;
+        const uint64_t one = 1;
+        if (::write(_state->wakeup, &one, sizeof(one)) < 0) { /* woken */ }
+    }
+
+
+#else // portable poll(2) fallback
+
+
+    struct reactor::state {
+        std::mutex              mutex;
+        std::vector<operation*> waiting;
+        std::atomic<size_t>     pending  { 0 };
+        std::atomic<bool>       stopping { false };
+
+        void wait(operation& op) {
+            std::lock_guard<std::mutex> lock(mutex);
+            waiting.push_back(&op);
+        }
+
+        bool cancel(operation& op) {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto itr = std::find(waiting.begin(), waiting.end(), &op);
+            if (itr == waiting.end()) return false;
+            waiting.erase(itr);
+            return true;
+        }
+    };
+
+
+    reactor::reactor()
+    : _state(new state) {}
+
+
+    reactor::~reactor() { delete _state; }
+
+
+    size_t
+    reactor::poll(int timeout_ms) {
+        if (_state->stopping) return 0;
+
+        // operations submitted meanwhile are picked up by the next poll
+        enum { LATENCY_MS = 10 };
+        if (timeout_ms < 0 or timeout_ms > LATENCY_MS) {
+            timeout_ms = LATENCY_MS;
+        }
+
+        std::vector<operation*> polling;
+        {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            polling.swap(_state->waiting);
+        }
+        if (polling.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            return 0;
+        }
+
+        std::vector<pollfd> fds(polling.size());
+        for (size_t i = 0; i < polling.size(); ++i) {
+            fds[i].fd      = polling[i]->socket;
+            fds[i].events  = is_write(*polling[i]) ? POLLOUT : POLLIN;
+            fds[i].revents = 0;
+        }
+        ::poll(fds.data(), fds.size(), timeout_ms);
+
+        size_t completed = 0;
+        for (size_t i = 0; i < polling.size(); ++i) {
+            operation* const op = polling[i];
+            if (fds[i].revents and attempt(*op)) {
+                _state->pending -= 1;
+                completed += 1;
+                op->resume(op->context);
+            }
+            else {
+                _state->wait(*op);
+            }
+        }
+        return completed;
+    }
+
+
+    void
+    reactor::stop() { _state->stopping = true; }
+
+
+#endif // NET_PLATFORM_LINUX
+
+
+    reactor&
+    reactor::shared() {
+        static reactor shared_reactor;
+        return shared_reactor;
+    }
+
+
+    size_t
+    reactor::pending() const { return _state->pending; }
+
+
+    bool
+    reactor::submit(operation& op) {
+        if (attempt(op)) return false;
+        _state->pending += 1;
+        _state->wait(op);
+        return true;
+    }
+
+
+    void
+    reactor::cancel(operation& op) {
+        if (_state->cancel(op)) _state->pending -= 1;
+    }
+
+
+    void
+    reactor::run() {
+        while (not _state->stopping) { poll(); }
+    }
+
+
+}} // namespace net::ip
+
+
+//==============================================================================
+
+
+namespace net {
+namespace http {
+
+
+    // method ==================================================================
+
+
+    const char*
+    method_to_string(http::method m) {
+        switch (m) {
+            default:      return "UNKNOWN";
             case CONNECT: return "CONNECT";
             case DELETE:  return "DELETE";
             case GET:     return "GET";
@@ -434,7 +1572,13 @@ namespace http {
 
     http::method
     string_to_method(const char* str) {
-        substr sub(str);
+        return string_to_method(substr(str));
+    }
+
+
+    http::method
+    string_to_method(std::string_view str) {
+        const substr sub(str.data(), str.size());
         if (sub.has_prefix("CONNECT")) return CONNECT;
         if (sub.has_prefix("DELETE"))  return DELETE;
         if (sub.has_prefix("GET"))     return GET;
@@ -453,7 +1597,13 @@ namespace http {
 
     http::status
     string_to_status(const char* str) {
-        substr sub(str);
+        return string_to_status(substr(str));
+    }
+
+
+    http::status
+    string_to_status(std::string_view str) {
+        const substr sub(str.data(), str.size());
         if (sub.has_prefix("100") or sub.has_prefix("Continue"))                        return CONTINUE;
         if (sub.has_prefix("101") or sub.has_prefix("Switching Protocols"))             return SWITCHING_PROTOCOLS;
         if (sub.has_prefix("102") or sub.has_prefix("Processing"))                      return PROCESSING;
@@ -560,215 +1710,419 @@ namespace http {
     }
 
 
-    // request =================================================================
+    // header ==================================================================
+
+
+    static const char* const header_names[HEADER_COUNT] = {
+        "",
+        "Accept",
+        "Accept-Encoding",
+        "Accept-Ranges",
+        "Authorization",
+        "Cache-Control",
+        "Connection",
+        "Content-Encoding",
+        "Content-Length",
+        "Content-Range",
+        "Content-Type",
+        "Cookie",
+        "Date",
+        "ETag",
+        "Expect",
+        "Host",
+        "If-Modified-Since",
+        "If-None-Match",
+        "If-Range",
+        "Last-Modified",
+        "Location",
+        "Range",
+        "Sec-WebSocket-Accept",
+        "Sec-WebSocket-Key",
+        "Sec-WebSocket-Version",
+        "Server",
+        "Set-Cookie",
+        "Transfer-Encoding",
+        "Upgrade",
+        "User-Agent",
+    };
 
 
-    static
-    substr
-    read_head(const substr& head, const substr& name) {
-        return
-            head
-            .after(name).after(":").skip(isspace)
-            .before("\r\n").truncate(isspace);
+    const char*
+    header_to_string(http::header id) {
+        return (id < HEADER_COUNT) ? header_names[id] : "";
+    }
+
+
+    // Candidates are bucketed by length and first letter, whose low five
+    // bits are the same in either case, so most names compare against one.
+    http::header
+    string_to_header(std::string_view name) {
+        enum { LONGEST = 24, WAYS = 4 };
+        static const struct table {
+            uint8_t ids[LONGEST + 1][32][WAYS] = {};
+            table() {
+                for (int id = 1; id < HEADER_COUNT; ++id) {
+                    const char* const s = header_names[id];
+                    uint8_t* const ways = ids[strlen(s)][s[0] & 31];
+                    size_t way = 0;
+                    while (ways[way]) ++way;
+                    assert(way < WAYS);
+                    ways[way] = uint8_t(id);
+                }
+            }
+        } table;
+
+        if (name.empty() or name.size() > LONGEST) return HEADER_UNKNOWN;
+        for (const uint8_t id : table.ids[name.size()][name[0] & 31]) {
+            if (id == 0) break;
+            if (iequals(name, header_names[id])) return http::header(id);
+        }
+        return HEADER_UNKNOWN;
     }
 
-    template<typename T>
+
+    // up to eight bytes, zero padded
     static
-    T
-    read_head(const substr& headers, const substr& name, T fallback = {}) {
-        substr value = read_head(headers, name);
-        return (value.empty()) ? fallback : string_to<T>(value);
+    uint64_t
+    load8(const char* data, size_t size) {
+        uint64_t word = 0;
+        memcpy(&word, data, std::min(size, sizeof(word)));
+        return word;
     }
 
 
-    void
-    request::reset() {
-        method = METHOD_UNKNOWN;
-        uri.clear();
-        query.clear();
-        headers.clear();
-        content.clear();
+    // lowercases the ASCII letters among eight bytes at once; adding to the
+    // low seven bits of each byte sets its high bit without carrying over
+    static
+    uint64_t
+    lower8(uint64_t word) {
+        constexpr uint64_t ones = 0x0101010101010101ull;
+        const uint64_t low7     = word & (0x7f * ones);
+        const uint64_t from_a   = low7 + (0x80 - 'A') * ones;
+        const uint64_t after_z  = low7 + (0x80 - 'Z' - 1) * ones;
+        const uint64_t upper    = from_a & ~after_z & ~word & (0x80 * ones);
+        return word | (upper >> 2);
     }
 
 
     bool
-    request::read(string& buffer) {
-        reset();
+    iequals(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) return false;
+        const size_t size = a.size();
+        for (size_t i = 0; i < size; i += 8) {
+            const size_t n = std::min(size - i, size_t(8));
+            if (lower8(load8(a.data() + i, n)) !=
+                lower8(load8(b.data() + i, n))) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-        const substr data = buffer;
 
-        substr head = data.including("\r\n\r\n");
-        if (not head) return false;
+    // whether the comma separated `list` holds `token`, ignoring case
+    static
+    bool
+    has_token(std::string_view list, std::string_view token) {
+        while (not list.empty()) {
+            const size_t comma = list.find(',');
+            std::string_view item = list.substr(0, comma);
+            while (item.size() and isspace((unsigned char)item.front())) {
+                item.remove_prefix(1);
+            }
+            while (item.size() and isspace((unsigned char)item.back())) {
+                item.remove_suffix(1);
+            }
+            if (iequals(item, token)) return true;
+            if (comma == list.npos) break;
+            list.remove_prefix(comma + 1);
+        }
+        return false;
+    }
 
-        const size_t heading_length = head.size();
-        const size_t content_length = read_head(head,"Content-Length",0);
-        const size_t message_length = heading_length + content_length;
 
-        const substr message = data.prefix(message_length);
-        if (not message) return false;
+    const string*
+    headers::find(std::string_view key) const {
+        if (const http::header id = string_to_header(key)) return known[id];
+        const auto itr = fields.lower_bound(key);
+        return (itr != fields.end() and itr->first == key)
+            ? &itr->second : nullptr;
+    }
 
-        // <method> <uri> HTTP/1.1\r\n
-        method = string_to_method(head.begin());
-        if (not method) {
-            reset();
-            return false;
+
+    void
+    headers::store(
+        http::header     id,
+        std::string_view key,
+        std::string_view value,
+        bool             replace
+    ) {
+        if (id) key = header_names[id];
+        if (replace) {
+            const auto range = fields.equal_range(key);
+            if (range.first != range.second) {
+                range.first->second = value;
+                fields.erase(std::next(range.first), range.second);
+                if (id) known[id] = &range.first->second;
+                return;
+            }
         }
+        const auto itr = fields.emplace(key, value);
+        if (id and not known[id]) known[id] = &itr->second;
+    }
 
-        substr url = 
-            head
-            .after(method_to_string(method))
-            .skip(isspace)
-            .before("HTTP/1.1\r\n")
-            .truncate(isspace);
 
-        uri = url;
+    void
+    headers::erase(std::string_view key) {
+        const http::header id = string_to_header(key);
+        if (id) key = header_names[id];
+        const auto range = fields.equal_range(key);
+        fields.erase(range.first, range.second);
+        if (id) known[id] = nullptr;
+    }
 
-        if (url.seek('?')) {
-            uri = url.before('?');
-            url = url.after('?');
-            while (url) {
-                if (const substr key = url.before('=')) {
-                    const substr value =
-                        (url.seek('&'))
-                        ? url.after('=').before('&')
-                        : url.after('=');
-                    query.set(string(key), string(value));
-                }
-                url = url.after('&');
-            }
-        }
 
-        head = head.after("HTTP/1.1\r\n");
-        while (head) {
-            if (const substr key = head.before(':')) {
-                const substr value =
-                    head
-                    .after(':')
-                    .skip(isspace)
-                    .before("\r\n")
-                    .truncate(isspace);
-                headers.set(string(key), string(value));
-            }
-            head = head.after("\r\n");
+    void
+    headers::index() {
+        for (auto& value : known) value = nullptr;
+        for (auto& pair : fields) {
+            const http::header id = string_to_header(pair.first);
+            if (id and not known[id]) known[id] = &pair.second;
         }
+    }
 
-        content = message.after("\r\n\r\n");
 
-        buffer.erase(0, message.length());
-        return true;
+    // query ===================================================================
+
+
+    static
+    int
+    hex_value(char c) {
+        if (c >= '0' and c <= '9') return c - '0';
+        if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' and c <= 'F') return c - 'A' + 10;
+        return -1;
     }
 
 
-    void
-    request::write(string& buffer) const {
-        buffer.append(method_to_string(method));
-        buffer.append(" ");
-        buffer.append(uri);
-        if (query.any()) {
-            buffer.append("?");
-            for (auto& pair : query) {
-                buffer.append(pair.first);
-                buffer.append("=");
-                buffer.append(pair.second);
-                buffer.append("&");
-            }
-            buffer.pop_back();
+    // finds the first '%' or '+', testing eight bytes at a time
+    static
+    const char*
+    find_escape(const char* p, const char* const end) {
+        const uint64_t ones  = 0x0101010101010101ull;
+        const uint64_t highs = 0x8080808080808080ull;
+        for (; end - p >= 8; p += 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            const uint64_t percent = word ^ (ones * '%');
+            const uint64_t plus    = word ^ (ones * '+');
+            const uint64_t zeros =
+                ((percent - ones) & ~percent) | ((plus - ones) & ~plus);
+            if (zeros & highs) break;
         }
-        buffer.append(" HTTP/1.1\r\n");
-        for (auto& pair : headers) {
-            buffer.append(pair.first);
-            buffer.append(": ");
-            buffer.append(pair.second);
-            buffer.append("\r\n");
+        for (; p < end; ++p) {
+            if (*p == '%' or *p == '+') return p;
         }
-        buffer.append("\r\n");
-        buffer.append(content);
+        return end;
     }
 
-    string
-    request::write() const {
-        string buffer;
-        write(buffer);
-        return buffer;
-    }
 
+    std::string_view
+    url_decode(std::string_view s, string& scratch) {
+        const char* p         = s.data();
+        const char* const end = p + s.size();
+        const char* escape    = find_escape(p, end);
+        if (escape == end) return s;
+
+        scratch.clear();
+        scratch.reserve(s.size());
+        while (escape != end) {
+            scratch.append(p, escape);
+            p = escape + 1;
+            if (*escape == '+') {
+                scratch.push_back(' ');
+            }
+            else if (end - p >= 2 and hex_value(p[0]) >= 0
+                                  and hex_value(p[1]) >= 0) {
+                scratch.push_back(char(hex_value(p[0]) << 4 | hex_value(p[1])));
+                p += 2;
+            }
+            else {
+                scratch.push_back('%');
+            }
+            escape = find_escape(p, end);
+        }
+        scratch.append(p, end);
+        return scratch;
+    }
 
-    response
-    request::send() const {
-        ip::address address(ip::TCP, uri);
-        if (not address.ok()) return {};
 
-        ip::socket socket;
-        if (auto err = socket.connect(address)) {
-            std::cout << "socket.connect(" << address << ") " << err << '\n';
-            return {};
+    void
+    url_encode(std::string_view s, string& buffer) {
+        static const char digits[] = "0123456789ABCDEF";
+        for (const char c : s) {
+            if (isalnum((unsigned char)c) or strchr("-._~", c)) {
+                buffer.push_back(c);
+            }
+            else if (c == ' ') {
+                buffer.push_back('+');
+            }
+            else {
+                buffer.push_back('%');
+                buffer.push_back(digits[(unsigned char)c >> 4]);
+                buffer.push_back(digits[(unsigned char)c & 15]);
+            }
         }
+    }
 
-        std::string  message = write();
-        ip::transfer tx = socket.sendall(message);
-        if (tx.error) {
-            std::cout << "socket.sendall(message) " << tx.error << '\n';
-            return {};
+
+    void
+    query::parse() const {
+        if (parsed) return;
+        parsed = true;
+        string key   (text.get_allocator());
+        string value (text.get_allocator());
+        for (auto pair : raw()) {
+            decoded.add(url_decode(pair.first, key),
+                        url_decode(pair.second, value));
         }
+    }
 
-        response response; string response_buffer;
 
-        char block[4096];
-        while ((tx = socket.recv(block)) and tx.size) {
-            response_buffer.append(block, tx.size);
-            if (response.read(response_buffer)) {
-                std::cout << "received!\n";
-                return response;
-            }
+    void
+    query::write(string& buffer) const {
+        if (not text.empty() or decoded.empty()) {
+            buffer.append(text);
+            return;
         }
+        for (auto& pair : decoded) {
+            url_encode(pair.first, buffer);
+            buffer.push_back('=');
+            url_encode(pair.second, buffer);
+            buffer.push_back('&');
+        }
+        buffer.pop_back();
+    }
 
-        if (tx.error) {
-            std::cout << "socket.recv(block) " << tx.error << '\n';
+
+    // request =================================================================
+
+
+    // the value of header `id` in a message head, found by its whole name
+    // at the start of a line, whatever its case
+    static
+    std::string_view
+    read_head(std::string_view head, http::header id) {
+        const std::string_view name = header_names[id];
+        size_t line = head.find("\r\n"); // past the start line
+        while (line != head.npos) {
+            line += 2;
+            const size_t end = head.find("\r\n", line);
+            if (end == head.npos) break;
+            std::string_view field = head.substr(line, end - line);
+            if (field.size() > name.size() and field[name.size()] == ':' and
+                iequals(field.substr(0, name.size()), name)) {
+                field.remove_prefix(name.size() + 1);
+                while (field.size() and isspace((unsigned char)field[0])) {
+                    field.remove_prefix(1);
+                }
+                while (field.size() and isspace((unsigned char)field.back())) {
+                    field.remove_suffix(1);
+                }
+                return field;
+            }
+            line = end;
         }
         return {};
     }
 
-
-    std::ostream& operator<<(std::ostream& out, const request& req) {
-        return out << req.write();
+    // the Content-Length of a message head, 0 if it has none; false if the
+    // header is malformed, negative, or too large to frame a message with
+    static
+    bool
+    read_content_length(std::string_view head, size_t& length) {
+        const std::string_view field = read_head(head, CONTENT_LENGTH);
+        length = 0;
+        if (field.data() == nullptr) return true; // absent
+        uint64_t value = 0;
+        if (not string_to(field, value)) return false;
+        if (value > SIZE_MAX - head.size()) return false;
+        length = size_t(value);
+        return true;
     }
 
 
-    // response ================================================================
+    request::request(http::arena& arena)
+    #if NET_HTTP_PMR
+    : request(allocator_type(&arena)) {}
+    #else
+    : request() { (void)arena; }
+    #endif
 
 
     void
-    response::reset() {
-        status = STATUS_UNKNOWN;
+    request::reset() {
+        method = METHOD_UNKNOWN;
+        uri.clear();
+        query.clear();
         headers.clear();
         content.clear();
     }
 
 
-    bool
-    response::read(string& buffer) {
+    void
+    request::reset(http::arena& arena) {
+    #if NET_HTTP_PMR
+        this->~request();
+        new(this)request(arena);
+    #else
+        (void)arena;
+        reset();
+    #endif
+    }
+
+
+    size_t
+    request::parse(std::string_view buffer) {
         reset();
 
-        const substr data = buffer;
+        const substr data(buffer.data(), buffer.size());
 
         substr head = data.including("\r\n\r\n");
-        if (not head) return false;
+        if (not head) return 0;
 
         const size_t heading_length = head.size();
-        const size_t content_length = read_head(head,"Content-Length",0);
+        size_t content_length = 0;
+        if (not read_content_length(head, content_length)) {
+            return heading_length; // unframeable, left reset to be refused
+        }
         const size_t message_length = heading_length + content_length;
 
         const substr message = data.prefix(message_length);
-        if (not message) return false;
+        if (not message) return 0;
 
-        // HTTP/1.1 <status-id> <status-name>\r\n
-        status = string_to_status(head.after("HTTP/1.1").skip(isspace));
-        if (not status) {
+        // <method> <uri> HTTP/1.1\r\n
+        method = string_to_method(head);
+        if (not method) {
             reset();
-            return false;
+            return 0;
         }
 
-        head = head.after("\r\n");
+        substr url = 
+            head
+            .after(method_to_string(method))
+            .skip(isspace)
+            .before("HTTP/1.1\r\n")
+            .truncate(isspace);
+
+        uri = url;
+
+        if (url.seek('?')) {
+            uri = url.before('?');
+            query.read(url.after('?'));
+        }
+
+        head = head.after("HTTP/1.1\r\n");
         while (head) {
             if (const substr key = head.before(':')) {
                 const substr value =
@@ -777,222 +2131,4631 @@ namespace http {
                     .skip(isspace)
                     .before("\r\n")
                     .truncate(isspace);
-                headers.set(string(key), string(value));
+                headers.set(key, value);
             }
             head = head.after("\r\n");
         }
 
         content = message.after("\r\n\r\n");
 
-        buffer.erase(0, message.length());
-        return true;
+        return message.length();
+    }
+
+
+    bool
+    request::read(string& buffer) {
+        const size_t length = parse(buffer);
+        buffer.erase(0, length);
+        return length > 0;
     }
 
 
     void
-    response::write(string& buffer) const {
-        buffer.append("HTTP/1.1 ");
-        buffer.append(to_string(int(status)));
+    request::write(string& buffer) const {
+        buffer.append(method_to_string(method));
         buffer.append(" ");
-        buffer.append(to_string(status));
-        buffer.append("\r\n");
-
+        buffer.append(uri);
+        if (query.any()) {
+            buffer.append("?");
+            query.write(buffer);
+        }
+        buffer.append(" HTTP/1.1\r\n");
         for (auto& pair : headers) {
             buffer.append(pair.first);
             buffer.append(": ");
             buffer.append(pair.second);
             buffer.append("\r\n");
         }
-
-        const size_t content_length = content.length();
-        if (not headers.has("Content-Length")) {
-            buffer.append("Content-Length: ");
-            buffer.append(to_string(content_length));
-            buffer.append("\r\n");
-        }
-
         buffer.append("\r\n");
-        buffer.append(content.data(), content_length);
+        buffer.append(content);
     }
 
-
     string
-    response::write() const {
+    request::write() const {
         string buffer;
         write(buffer);
         return buffer;
     }
 
 
-    std::ostream& operator<<(std::ostream& out, const response& res) {
-        return out << res.write();
-    }
-
-
-    // get =====================================================================
-
-
+    // sends `request` over the connected `socket` and receives its response
+    static
     response
-    get(string uri, pairs query, pairs headers) {
-        request req { GET, uri, {}, std::move(headers) };
-        return req.send();
-    }
+    exchange(const ip::socket& socket, const request& request) {
+        string       message = request.write();
+        ip::transfer tx = socket.sendall(message);
+        if (tx.error) return {};
 
+        response response; string response_buffer;
 
-    response
-    getJSON(string uri, pairs query) {
-        pairs headers {{"Accept", "application/json"}};
-        return get(uri, std::move(query), std::move(headers));
+        char block[4096];
+        while ((tx = socket.recv({ block, ip::NO_FILL })) and tx.size) {
+            response_buffer.append(block, tx.size);
+            if (response.read(response_buffer)) return response;
+        }
+        return {};
     }
 
 
     response
-    getHTML(string uri, pairs query) {
-        pairs headers {{"Accept", "text/html"}};
-        return get(uri, std::move(query), std::move(headers));
-    }
-
+    request::send() const {
+        ip::address address(ip::TCP, uri.c_str());
+        if (not address.ok()) return {};
 
-    response
-    getText(string uri, pairs query) {
-        pairs headers {{"Accept", "text/plain"}};
-        return get(uri, std::move(query), std::move(headers));
+        // with Fast Open the request rides in the SYN once the server has
+        // handed out a cookie; connect() then returns at once, and a refused
+        // connection fails the send instead
+        ip::socket socket;
+        if (socket.open(address.protocol)) return {};
+        socket.fastopen_connect(true); // where unsupported, a plain connect
+        if (socket.connect(address)) return {};
+        return exchange(socket, *this);
     }
 
 
-    // server ==================================================================
-
-
-    server::client::client(ip::socket&& s)
-    : socket(std::move(s))
-    , id(socket.id) {
-        //printf("client::client(%i)\n", id);
+    response
+    request::send(const ip::path& path) const {
+        ip::socket socket;
+        if (socket.connect(path)) return {};
+        return exchange(socket, *this);
     }
 
 
-    server::client::~client() {
-        //printf("client::~client(%i)\n", id);
+    std::ostream& operator<<(std::ostream& out, const request& req) {
+        return out << req.write();
     }
 
 
-    //--------------------------------------------------------------------------
+    // date ====================================================================
 
 
-    uint16_t
-    server::port() const {
-        return listener.port();
-    }
+    /*--------------------------------------------------------------------------
+    The server stamps every response with a Date header, which changes once a
+    second; a clock thread formats it on each tick so responses only copy it.
+    --------------------------------------------------------------------------*/
+    class date_clock {
+    public:
 
+        enum { SIZE = sizeof("Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n") - 1 };
 
-    //--------------------------------------------------------------------------
+    private:
 
+        enum { WORDS = (SIZE + 7) / 8 };
 
-    ip::error
-    server::start(uint16_t port) {
-        if (listener.ok()) stop();
+        // a seqlock over the line, stored a word at a time: odd while the
+        // clock thread stores it, so a reader that overlaps a store retries
+        std::atomic<uint64_t> sequence { 0 };
+        std::atomic<uint64_t> words[WORDS];
 
-        if (auto err = listener.open(ip::TCP))
-            return err;
+        date_clock() {
+            publish(std::chrono::system_clock::now());
+            std::thread([this]{ tick(); }).detach();
+        }
 
-        if (auto err = listener.bind(port))
-            return err;
+        void tick() {
+            using namespace std::chrono;
+            for (;;) {
+                const auto now  = system_clock::now();
+                const auto next = time_point_cast<seconds>(now) + seconds(1);
+                std::this_thread::sleep_until(next);
+                publish(system_clock::now());
+            }
+        }
 
-        if (auto err = listener.listen())
-            return err;
+        // formats and stores the line; only ever called by one thread
+        void publish(std::chrono::system_clock::time_point t) {
+            uint64_t line[WORDS] = {};
+            format((char*)line, t);
+            const uint64_t stored = sequence.load(std::memory_order_relaxed);
+            sequence.store(stored + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (int i = 0; i < WORDS; ++i) {
+                words[i].store(line[i], std::memory_order_relaxed);
+            }
+            sequence.store(stored + 2, std::memory_order_release);
+        }
 
-        std::thread([this]{ listen(); }).detach();
-        return ip::error::none();
-    }
+    public:
+
+        // IMF-fixdate (RFC 7231), independent of the C locale
+        static void format(char* out, std::chrono::system_clock::time_point t) {
+            static const char days[]   = "ThuFriSatSunMonTueWed";
+            static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+            const long long epoch = std::chrono::duration_cast<
+                std::chrono::seconds>(t.time_since_epoch()).count();
+            const long long day  = epoch / 86400;
+            const int       secs = int(epoch % 86400);
+
+            // civil date from days since 1970-01-01
+            const long long z   = day + 719468;
+            const long long era = z / 146097;
+            const unsigned  doe = unsigned(z - era * 146097);
+            const unsigned  yoe =
+                (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+            const unsigned  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+            const unsigned  mp  = (5 * doy + 2) / 153;
+            const unsigned  d   = doy - (153 * mp + 2) / 5 + 1;
+            const unsigned  m   = mp < 10 ? mp + 3 : mp - 9;
+            const unsigned  y   = unsigned(yoe + era * 400 + (m <= 2));
+
+            auto two = [](char* p, unsigned v) {
+                p[0] = char('0' + v / 10); p[1] = char('0' + v % 10);
+            };
+
+            memcpy(out, "Date: ", 6);
+            memcpy(out + 6, days + (day % 7) * 3, 3);
+            memcpy(out + 9, ", ", 2);
+            two(out + 11, d);
+            out[13] = ' ';
+            memcpy(out + 14, months + (m - 1) * 3, 3);
+            out[17] = ' ';
+            two(out + 18, y / 100);
+            two(out + 20, y % 100);
+            out[22] = ' ';
+            two(out + 23, unsigned(secs / 3600));
+            out[25] = ':';
+            two(out + 26, unsigned(secs / 60 % 60));
+            out[28] = ':';
+            two(out + 29, unsigned(secs % 60));
+            memcpy(out + 31, " GMT\r\n", 6);
+        }
 
+        // never destroyed, since the clock thread outlives main()
+        static date_clock& shared() {
+            static date_clock* const clock = new date_clock();
+            return *clock;
+        }
 
-    void
-    server::stop() {
-        listener.close();
+        // copies the current "Date: ...\r\n" line into `out`
+        std::string_view read(char (&out)[SIZE]) const {
+            uint64_t line[WORDS];
+            for (;;) {
+                const uint64_t stored = sequence.load(std::memory_order_acquire);
+                if (stored & 1) continue; // being stored
+                for (int i = 0; i < WORDS; ++i) {
+                    line[i] = words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == stored) break;
+            }
+            memcpy(out, line, SIZE);
+            return { out, SIZE };
+        }
+    };
 
-        // wait for listen thread to stop
-        lock listen_lock(listen_mutex);
 
-        // now that listen thread has stopped,
-        // no additional clients can be added.
+    // file ====================================================================
 
-        {
-            // close all client sockets
-            lock clients_lock(clients_mutex);
-            for (auto& c : clients) { c->socket.close(); }
 
+    file_ptr
+    file::open(const char* path) {
+#if NET_COMPILER_MSVC
+        (void)path;
+        return nullptr; // not yet
+#else
+        const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        if (fstat(fd, &st) != 0 or not S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return nullptr;
         }
+        const uint64_t size = uint64_t(st.st_size);
 
-        for (;;) {
-            // wait for all client threads to stop
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            lock clients_lock(clients_mutex);
-            if (clients.empty()) break;
-            //puts("server::stop() waiting for client threads...");
-        }
+        char etag[40];
+        const int length = snprintf(
+            etag, sizeof(etag), "\"%llx-%llx\"",
+            (unsigned long long)size, (unsigned long long)st.st_mtime);
 
-        //puts("server::stop() DONE");
+        char date[date_clock::SIZE];
+        date_clock::format(
+            date, std::chrono::system_clock::from_time_t(st.st_mtime));
+        const std::string_view modified(date + 6, date_clock::SIZE - 8);
+
+        return file_ptr(new file(
+            fd, size, std::string(etag, size_t(length)),
+            std::string(modified)));
+#endif
     }
 
 
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    file::~file() { ::close(fd); }
 
 
-    void
-    server::listen() {
-        lock listen_lock(listen_mutex);
-        //printf("server::listen() on port %u\n", listener.port());
-        while (listener.ok()) {
-            if (auto err = listener.listen()) {
-                printf("server::listen() error: '%s'\n", err.message());
+    // range ===================================================================
+
+
+    bool
+    parse_ranges(
+        std::string_view         header,
+        uint64_t                 size,
+        std::vector<byte_range>& ranges
+    ) {
+        ranges.clear();
+
+        const std::string_view unit = "bytes=";
+        if (not iequals(header.substr(0, unit.size()), unit)) return false;
+        header.remove_prefix(unit.size());
+
+        auto number = [](std::string_view s, uint64_t& value) {
+            const char* const end = s.data() + s.size();
+            const auto result = std::from_chars(s.data(), end, value);
+            return s.size() and result.ec == std::errc() and result.ptr == end;
+        };
+        auto blank = [](char c) { return c == ' ' or c == '\t'; };
+
+        size_t listed = 0;
+        while (header.size()) {
+            const size_t comma = std::min(header.find(','), header.size());
+            std::string_view spec = header.substr(0, comma);
+            header.remove_prefix(std::min(comma + 1, header.size()));
+
+            while (spec.size() and blank(spec.front())) spec.remove_prefix(1);
+            while (spec.size() and blank(spec.back()))  spec.remove_suffix(1);
+            if (spec.empty()) continue; // "bytes=0-1,,2-3" is allowed
+            if (++listed > MAX_RANGES) return false;
+
+            const size_t dash = spec.find('-');
+            if (dash == spec.npos) return false;
+            const std::string_view from = spec.substr(0, dash);
+            const std::string_view to   = spec.substr(dash + 1);
+
+            uint64_t first = 0, last = 0;
+            if (from.empty()) {
+                // the last `to` bytes
+                if (not number(to, last)) return false;
+                if (last == 0 or size == 0) continue;
+                ranges.push_back({ size - std::min(last, size), size - 1 });
                 continue;
             }
-            if (ip::socket socket = listener.accept()) {
-                lock clients_lock(clients_mutex);
-                auto result = clients.emplace(new client(std::move(socket)));
-                assert(result.second); // successfully emplaced
-                std::thread([this,result]{ serve(*result.first); }).detach();
+            if (not number(from, first)) return false;
+            if (to.empty()) {
+                last = UINT64_MAX;
             }
+            else if (not number(to, last) or last < first) {
+                return false;
+            }
+            if (first >= size) continue;
+            ranges.push_back({ first, std::min(last, size - 1) });
         }
-        //puts("server::listen() DONE");
+        return listed > 0;
     }
 
 
-    void
-    server::serve(const client_ptr& client_ptr) {
-        client& client = *client_ptr;
-        socket& socket = client.socket;
+    // response ================================================================
 
-        //const int client_id = client.id;
-        //printf("client(%i) connected on port %u\n", client_id, socket.port());
 
-        request  request;  string request_buffer;
-        response response; string response_buffer;
+    response::response(http::arena& arena)
+    #if NET_HTTP_PMR
+    : response(allocator_type(&arena)) {}
+    #else
+    : response() { (void)arena; }
+    #endif
+
+
+    void
+    response::reset() {
+        status = STATUS_UNKNOWN;
+        headers.clear();
+        content.clear();
+        file.reset();
+    }
+
+
+    void
+    response::reset(http::arena& arena) {
+    #if NET_HTTP_PMR
+        this->~response();
+        new(this)response(arena);
+    #else
+        (void)arena;
+        reset();
+    #endif
+    }
+
+
+    // reads the status line and headers of a response's head
+    static
+    bool
+    read_response_head(substr head, response& response) {
+        // HTTP/1.1 <status-id> <status-name>\r\n
+        response.status =
+            string_to_status(head.after("HTTP/1.1").skip(isspace));
+        if (not response.status) return false;
+
+        head = head.after("\r\n");
+        while (head) {
+            if (const substr key = head.before(':')) {
+                const substr value =
+                    head
+                    .after(':')
+                    .skip(isspace)
+                    .before("\r\n")
+                    .truncate(isspace);
+                response.headers.set(key, value);
+            }
+            head = head.after("\r\n");
+        }
+        return true;
+    }
+
+
+    // whether a response has no body, whatever its Content-Length says
+    static
+    bool
+    bodiless(http::method method, int code) {
+        return
+            method == HEAD or code < 200 or code == 204 or code == 304;
+    }
+
+
+    size_t
+    response::parse(std::string_view buffer) {
+        return parse(buffer, GET);
+    }
+
+
+    size_t
+    response::parse(std::string_view buffer, http::method method) {
+        reset();
+
+        const substr data(buffer.data(), buffer.size());
+
+        const substr head = data.including("\r\n\r\n");
+        if (not head) return 0;
+
+        const size_t heading_length = head.size();
+        const http::status code =
+            string_to_status(head.after("HTTP/1.1").skip(isspace));
+        size_t content_length = 0;
+        if (not bodiless(method, code) and
+            not read_content_length(head, content_length)) {
+            return heading_length; // unframeable, left reset to be refused
+        }
+        const size_t message_length = heading_length + content_length;
+
+        const substr message = data.prefix(message_length);
+        if (not message) return 0;
+
+        if (not read_response_head(head, *this)) {
+            reset();
+            return 0;
+        }
+
+        content = message.after("\r\n\r\n");
+
+        return message.length();
+    }
+
+
+    bool
+    response::read(string& buffer) {
+        const size_t length = parse(buffer);
+        buffer.erase(0, length);
+        return length > 0;
+    }
+
+
+    // "HTTP/1.1 200 OK\r\n", formatted once per status code
+    static
+    std::string_view
+    status_line(http::status status) {
+        enum { CODES = 1000 };
+        static const struct table {
+            std::string lines[CODES];
+            table() {
+                for (int code = 0; code < CODES; ++code) {
+                    lines[code] =
+                        "HTTP/1.1 " + std::to_string(code) + " " +
+                        status_to_string(http::status(code)) + "\r\n";
+                }
+            }
+        } table;
+        const int code = (status >= 0 and int(status) < CODES) ? status : 0;
+        return table.lines[code];
+    }
+
+
+    // writes the head of `response`, with a Content-Length of `length`
+    // unless it has its own
+    static
+    void
+    write_head(
+        const response&  response,
+        string&          buffer,
+        std::string_view date,
+        uint64_t         length
+    ) {
+        const auto& headers = response.headers;
+
+        const std::string_view line = status_line(response.status);
+
+        static const std::string_view length_name = "Content-Length: ";
+        char digits[24];
+        const auto end = std::to_chars(digits, digits + sizeof(digits), length);
+        const bool has_length = headers.has(CONTENT_LENGTH);
+
+        // size the buffer exactly, then copy each piece once; a file body
+        // is not copied into it
+        size_t size = line.size() + date.size() + 2;
+        if (not response.file) size += size_t(length);
+        for (auto& pair : headers) {
+            size += pair.first.size() + 2 + pair.second.size() + 2;
+        }
+        if (not has_length) {
+            size += length_name.size() + size_t(end.ptr - digits) + 2;
+        }
+        const size_t required = buffer.size() + size;
+        if (buffer.capacity() < required) {
+            buffer.reserve(std::max(required, buffer.capacity() * 2));
+        }
+
+        buffer.append(line);
+        buffer.append(date);
+        for (auto& pair : headers) {
+            buffer.append(pair.first);
+            buffer.append(": ", 2);
+            buffer.append(pair.second);
+            buffer.append("\r\n", 2);
+        }
+        if (not has_length) {
+            buffer.append(length_name);
+            buffer.append(digits, end.ptr);
+            buffer.append("\r\n", 2);
+        }
+        buffer.append("\r\n", 2);
+    }
+
+
+    void
+    response::write(string& buffer) const {
+        if (not file) {
+            write_head(*this, buffer, {}, content.length());
+            buffer.append(content);
+            return;
+        }
+        write_head(*this, buffer, {}, file->size);
+#if !NET_COMPILER_MSVC
+        const size_t offset = buffer.size();
+        buffer.resize(offset + size_t(file->size));
+        size_t done = 0;
+        while (done < file->size) {
+            const ssize_t n = pread(
+                file->fd, &buffer[offset + done], size_t(file->size) - done,
+                off_t(done));
+            if (n <= 0) break;
+            done += size_t(n);
+        }
+        buffer.resize(offset + done);
+#endif
+    }
+
+
+    string
+    response::write() const {
+        string buffer;
+        write(buffer);
+        return buffer;
+    }
+
+
+    std::ostream& operator<<(std::ostream& out, const response& res) {
+        return out << res.write();
+    }
+
+
+    // get =====================================================================
+
+
+    response
+    get(string uri, pairs query, pairs headers) {
+        request req { GET, uri, std::move(query), std::move(headers) };
+        return req.send();
+    }
+
+
+    response
+    getJSON(string uri, pairs query) {
+        pairs headers {{"Accept", "application/json"}};
+        return get(uri, std::move(query), std::move(headers));
+    }
+
+
+    response
+    getHTML(string uri, pairs query) {
+        pairs headers {{"Accept", "text/html"}};
+        return get(uri, std::move(query), std::move(headers));
+    }
+
+
+    response
+    getText(string uri, pairs query) {
+        pairs headers {{"Accept", "text/plain"}};
+        return get(uri, std::move(query), std::move(headers));
+    }
+
+
+    // send_many ===============================================================
+
+
+    namespace {
+
+        // the requests to one host, pipelined over one connection
+        struct pipeline {
+            ip::address         address;
+            ip::socket          socket;
+            std::vector<size_t> queue;        // request indices, in send order
+            size_t              answered = 0; // responses received from queue
+            string              output;
+            size_t              sent = 0;
+            string              input;
+            bool                connecting = false;
+            bool                reopened = false;
+            bool                finished = false;
+
+            bool unanswered() const { return answered < queue.size(); }
+
+            ip::error open() {
+                socket.close();
+                connecting = true;
+                if (auto err = socket.open(ip::TCP)) return err;
+                if (auto err = socket.nonblocking(true)) return err;
+                socket.nodelay(true);
+                ip::error err = socket.connect(address);
+                if (err and not ip::would_block()) return err;
+                return ip::error::none();
+            }
+
+            pollfd events() const {
+                pollfd fd;
+                fd.fd      = socket.id;
+                fd.events  = POLLIN;
+                fd.revents = 0;
+                if (connecting or sent < output.size()) fd.events |= POLLOUT;
+                return fd;
+            }
+
+            // connects, sends and receives as `revents` allow, parsing each
+            // response into `response`, framed by its request's method in
+            // `requests`, and passing the request's index to `answered`;
+            // interim 1xx responses are skipped; returns an error once the
+            // connection has failed
+            template<typename Answered>
+            ip::error
+            pump(
+                short                revents,
+                const http::request* requests,
+                http::response&      out,
+                Answered&&           on_answer
+            ) {
+                if (connecting) {
+                    int err = 0; socklen_t size = sizeof(err);
+                    getsockopt(
+                        socket.id, SOL_SOCKET, SO_ERROR, (char*)&err, &size);
+                    if (err) return ip::error(err);
+                    if (not (revents & (POLLOUT | POLLIN))) {
+                        return ip::error::none();
+                    }
+                    connecting = false;
+                }
+
+                if ((revents & POLLOUT) and sent < output.size()) {
+                    const ip::source rest(
+                        output.data() + sent, output.size() - sent);
+                    const ip::transfer tx = socket.send(rest);
+                    if (tx.error) {
+                        if (not ip::would_block()) return tx.error;
+                    }
+                    sent += tx.size;
+                }
+
+                if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                    ip::buffer block = ip::buffer::borrow();
+                    const ip::transfer rx = socket.recv(block.target());
+                    if (rx.error) {
+                        if (not ip::would_block()) return rx.error;
+                        return ip::error::none();
+                    }
+                    if (rx.size == 0) return ip::error(ECONNRESET);
+                    input.append(block.data, rx.size);
+                    while (unanswered()) {
+                        const http::method method =
+                            requests[queue[answered]].method;
+                        const size_t length = out.parse(input, method);
+                        if (length == 0) break;
+                        input.erase(0, length);
+                        if (not out.ok()) return ip::error(EPROTO);
+                        if (out.status < 200) continue; // interim
+                        on_answer(queue[answered++]);
+                    }
+                    if (not unanswered()) {
+                        finished = true;
+                        socket.close();
+                    }
+                }
+                return ip::error::none();
+            }
+        };
+
+    } // namespace
+
+
+    static
+    bool
+    idempotent(http::method m) {
+        switch (m) {
+            case GET: case HEAD: case PUT: case DELETE:
+            case OPTIONS: case TRACE: return true;
+            default: return false;
+        }
+    }
+
+
+    void
+    send_many(
+        const request*    requests,
+        size_t            count,
+        int               timeout_ms,
+        const completion& on_response
+    ) {
+        using clock = std::chrono::steady_clock;
+        const clock::time_point deadline =
+            clock::now() + std::chrono::milliseconds(timeout_ms);
+
+        std::vector<pipeline>         pipelines;
+        std::map<std::string, size_t> hosts;
+        pipelines.reserve(count);
+
+        http::response response;
+        size_t outstanding = count;
+
+        auto complete = [&](size_t index, ip::error err) {
+            http::response none;
+            on_response(index, err ? none : response, err);
+            outstanding -= 1;
+        };
+
+        auto fail = [&](pipeline& p, ip::error err) {
+            for (size_t i = p.answered; i < p.queue.size(); ++i) {
+                complete(p.queue[i], err);
+            }
+            p.answered = p.queue.size();
+            p.finished = true;
+            p.socket.close();
+        };
+
+        // group by host, resolving each host once
+        for (size_t index = 0; index < count; ++index) {
+            const request& r = requests[index];
+            const ip::host host(r.uri);
+            const std::string key = std::string(host.addr) + ':' + host.port;
+            auto found = hosts.find(key);
+            if (found == hosts.end()) {
+                found = hosts.emplace(key, pipelines.size()).first;
+                pipelines.emplace_back();
+                pipelines.back().address = ip::address(ip::TCP, r.uri.c_str());
+            }
+            pipeline& p = pipelines[found->second];
+            p.queue.push_back(index);
+            r.write(p.output);
+        }
+
+        for (pipeline& p : pipelines) {
+            if (not p.address.ok()) {
+                fail(p, ip::error(EHOSTUNREACH));
+            }
+            else if (auto err = p.open()) {
+                fail(p, err);
+            }
+        }
+
+        // a connection closed with requests unanswered is reopened once,
+        // resending those requests; those that are not idempotent may have
+        // been served already, and fail instead; an unframeable response
+        // fails the connection's requests without a retry
+        auto reopen_or_fail = [&](pipeline& p, ip::error err) {
+            if (p.reopened or not p.unanswered() or err.id == EPROTO) {
+                fail(p, err);
+                return;
+            }
+            p.reopened = true;
+            p.queue.erase(p.queue.begin(), p.queue.begin() + p.answered);
+            p.answered = 0;
+            std::vector<size_t> resent;
+            for (size_t index : p.queue) {
+                if (idempotent(requests[index].method)) {
+                    resent.push_back(index);
+                }
+                else complete(index, err);
+            }
+            p.queue.swap(resent);
+            if (p.queue.empty()) {
+                p.finished = true;
+                p.socket.close();
+                return;
+            }
+            p.output.clear();
+            p.sent = 0;
+            p.input.clear();
+            for (size_t index : p.queue) requests[index].write(p.output);
+            if (auto e = p.open()) fail(p, e);
+        };
+
+        std::vector<pollfd>    polls;
+        std::vector<pipeline*> polled;
+        while (outstanding) {
+            int wait = -1;
+            if (timeout_ms >= 0) {
+                const auto left = deadline - clock::now();
+                if (left <= clock::duration::zero()) break;
+                wait = int(std::chrono::duration_cast<
+                    std::chrono::milliseconds>(left).count()) + 1;
+            }
+
+            polls.clear();
+            polled.clear();
+            for (pipeline& p : pipelines) {
+                if (p.finished) continue;
+                polls.push_back(p.events());
+                polled.push_back(&p);
+            }
+
+            const int ready = poll(polls.data(), polls.size(), wait);
+            if (ready < 0 and errno != EINTR) break;
+            if (ready <= 0) continue;
+
+            for (size_t i = 0; i < polls.size(); ++i) {
+                pipeline& p = *polled[i];
+                if (not polls[i].revents) continue;
+                auto answered = [&](size_t index) {
+                    complete(index, ip::error::none());
+                };
+                const ip::error err =
+                    p.pump(polls[i].revents, requests, response, answered);
+                if (err) {
+                    reopen_or_fail(p, err);
+                }
+            }
+        }
+
+        for (pipeline& p : pipelines) {
+            if (p.unanswered()) fail(p, ip::error(ETIMEDOUT));
+        }
+    }
+
+
+    void
+    send_many(
+        const std::vector<request>& requests,
+        int                         timeout_ms,
+        const completion&           on_response
+    ) {
+        send_many(requests.data(), requests.size(), timeout_ms, on_response);
+    }
+
+
+    void
+    get_many(
+        const std::vector<string>& uris,
+        int                        timeout_ms,
+        const completion&          on_response
+    ) {
+        std::vector<request> requests;
+        requests.reserve(uris.size());
+        for (const string& uri : uris) requests.emplace_back(GET, uri);
+        send_many(requests, timeout_ms, on_response);
+    }
+
+
+    // hedging =================================================================
+
+
+    int
+    hedging::delay_ms() const {
+        int window[SAMPLES];
+        size_t count;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            count = std::min(recorded, size_t(SAMPLES));
+            if (count < MIN_SAMPLES) return max_delay_ms;
+            std::copy(samples, samples + count, window);
+        }
+        const double p = std::min(std::max(percentile, 0.0), 1.0);
+        int* const nth = window + std::min(size_t(p * count), count - 1);
+        std::nth_element(window, nth, window + count);
+        const int delay = (*nth + 999) / 1000;
+        return std::min(std::max(delay, min_delay_ms), max_delay_ms);
+    }
+
+
+    void
+    hedging::record(int latency_us) {
+        std::lock_guard<std::mutex> lock(mutex);
+        samples[recorded++ % SAMPLES] = latency_us;
+    }
+
+
+    response
+    request::send(http::hedging& policy) const {
+        if (not idempotent(method)) return send();
+
+        enum { MAX_ADDRESSES = 4 };
+        ip::address addresses[MAX_ADDRESSES];
+        size_t count = 0;
+        ip::addresses(ip::TCP, uri.c_str(), [&](ip::address a) {
+            addresses[count++] = a;
+            return (count < MAX_ADDRESSES) ? ip::CONTINUE : ip::BREAK;
+        });
+        if (count == 0) return {};
+
+        using namespace std::chrono;
+        const auto start    = steady_clock::now();
+        const auto deadline = start + milliseconds(policy.timeout_ms);
+        const auto hedge_at = start + milliseconds(policy.delay_ms());
+        policy.calls += 1;
+
+        // attempt 1 is the hedge, to the next address if there is one
+        pipeline attempts[2];
+        size_t   started = 0;
+        auto begin = [&]() {
+            pipeline& p = attempts[started];
+            p.address = addresses[started % count];
+            p.queue.push_back(0); // this request
+            write(p.output);
+            if (p.open()) p.finished = true;
+            started += 1;
+        };
+        begin();
+
+        http::response response;
+        size_t winner = 0;
+        bool   answered = false;
+        while (not answered) {
+            const auto now = steady_clock::now();
+            if (policy.timeout_ms >= 0 and now >= deadline) break;
+            if (started == 1 and (now >= hedge_at or attempts[0].finished)) {
+                policy.hedges += 1;
+                begin();
+                continue;
+            }
+            if (attempts[0].finished and attempts[1].finished) break;
+
+            auto ms_until = [&](steady_clock::time_point t) {
+                return int(duration_cast<milliseconds>(t - now).count()) + 1;
+            };
+            int wait = (started == 1) ? ms_until(hedge_at) : -1;
+            if (policy.timeout_ms >= 0) {
+                const int left = ms_until(deadline);
+                wait = (wait < 0) ? left : std::min(wait, left);
+            }
+
+            pollfd polls[2];
+            size_t polled[2];
+            size_t n = 0;
+            for (size_t i = 0; i < started; ++i) {
+                if (attempts[i].finished) continue;
+                polls[n] = attempts[i].events();
+                polled[n++] = i;
+            }
+            const int ready = poll(polls, n, wait);
+            if (ready < 0 and errno != EINTR) break;
+            if (ready <= 0) continue;
+
+            for (size_t i = 0; i < n and not answered; ++i) {
+                if (not polls[i].revents) continue;
+                pipeline& p = attempts[polled[i]];
+                auto on_answer = [&](size_t) {
+                    winner = polled[i];
+                    answered = true;
+                };
+                if (p.pump(polls[i].revents, this, response, on_answer)) {
+                    p.finished = true;
+                    p.socket.close();
+                }
+            }
+        }
+
+        if (not answered) return {};
+
+        // the primary's latency; when the hedge wins the primary is known
+        // only to be slower than the delay, and recording the hedge's own
+        // latency would pull the delay down with every win
+        auto latency = steady_clock::now() - start;
+        if (winner == 1) {
+            policy.wins += 1;
+            const steady_clock::duration delay = hedge_at - start;
+            latency = std::min(latency, delay);
+        }
+        policy.record(int(duration_cast<microseconds>(latency).count()));
+        return response; // the losing attempt closes with `attempts`
+    }
+
+
+    // proxy ===================================================================
+
+
+    // a 64 bit hash of `s`, FNV-1a
+    static
+    uint64_t
+    fnv1a(std::string_view s) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (const char c : s) h = (h ^ uint8_t(c)) * 0x100000001b3ull;
+        return h;
+    }
+
+
+    // scrambles `x` so that nearby values spread apart (splitmix64)
+    static
+    uint64_t
+    mix64(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+
+    struct proxy::upstream {
+        const std::string       name;
+        const ip::address       address;
+        std::atomic<int>        outstanding { 0 };
+        std::atomic<bool>       up { true };
+        std::mutex              mutex;
+        std::vector<ip::socket> idle; // most recently used last
+
+        explicit
+        upstream(const std::string& name)
+        : name(name)
+        , address(ip::TCP, name.c_str()) {}
+
+        // a kept-open connection, or else a new one
+        ip::socket checkout(int timeout_ms, bool& reused) {
+            for (;;) {
+                ip::socket socket;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (idle.empty()) break;
+                    socket = std::move(idle.back());
+                    idle.pop_back();
+                }
+                // an idle connection with anything to read has been closed,
+                // or has broken the protocol
+                pollfd p;
+                p.fd      = socket.id;
+                p.events  = POLLIN;
+                p.revents = 0;
+                if (poll(&p, 1, 0) == 0) {
+                    reused = true;
+                    return socket;
+                }
+            }
+            reused = false;
+            ip::socket socket;
+            if (socket.open(address.protocol)) return {};
+            socket.timeout(timeout_ms);
+            if (socket.connect(address)) return {};
+            socket.nodelay(true);
+            return socket;
+        }
+
+        void checkin(ip::socket&& socket, size_t max_idle) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (idle.size() < max_idle) idle.push_back(std::move(socket));
+        }
+    };
+
+
+    // headers about a single connection, which a proxy does not forward
+    static
+    bool
+    hop_by_hop(std::string_view name, std::string_view connection) {
+        static const std::string_view names[] = {
+            "Connection", "Keep-Alive", "Proxy-Authenticate",
+            "Proxy-Authorization", "Proxy-Connection", "TE", "Trailer",
+            "Transfer-Encoding", "Upgrade",
+        };
+        for (const std::string_view n : names) {
+            if (iequals(name, n)) return true;
+        }
+        return has_token(connection, name);
+    }
+
+
+    // the head of `request` as forwarded upstream; its body is sent as is,
+    // so Expect is dropped along with the hop-by-hop headers
+    static
+    void
+    write_forwarded(const request& request, string& head) {
+        head.append(method_to_string(request.method));
+        head.append(" ");
+        head.append(request.uri);
+        if (request.query.any()) {
+            head.append("?");
+            request.query.write(head);
+        }
+        head.append(" HTTP/1.1\r\n");
+
+        const auto& headers = request.headers;
+        const std::string_view connection = headers.get(CONNECTION);
+        std::string_view via;
+        for (auto& pair : headers) {
+            const std::string_view name = pair.first;
+            if (hop_by_hop(name, connection)) continue;
+            if (name == "Content-Length" or name == "Expect") continue;
+            if (iequals(name, "Via")) { via = pair.second; continue; }
+            head.append(name);
+            head.append(": ");
+            head.append(pair.second);
+            head.append("\r\n");
+        }
+        head.append("Via: ");
+        if (via.size()) head.append(via).append(", ");
+        head.append("1.1 net\r\n");
+        if (request.content.size() or headers.has(CONTENT_LENGTH)) {
+            char digits[24];
+            const auto end = std::to_chars(
+                digits, digits + sizeof(digits), request.content.size());
+            head.append("Content-Length: ");
+            head.append(digits, end.ptr);
+            head.append("\r\n");
+        }
+        head.append("\r\n");
+    }
+
+
+    // how an upstream answered: an unforwardable response is chunked, or
+    // larger than allowed, or has no valid length
+    enum upstream_answer { ANSWERED, UNANSWERED, UNFORWARDABLE };
+
+
+    // Sends a request and receives its response into `response`, reading
+    // the body straight into response.content, whose length it is given
+    // up front, or else until the upstream closes the connection.  Chunked
+    // responses, and bodies over `max_content` bytes, are refused.
+    static
+    upstream_answer
+    exchange(
+        const ip::socket& socket,
+        std::string_view  head,
+        std::string_view  body,
+        http::method      method,
+        size_t            max_content,
+        response&         response,
+        bool&             keep_alive
+    ) {
+        response.reset();
+        if (socket.sendall(ip::source(head.data(), head.size())).error) {
+            return UNANSWERED;
+        }
+        if (body.size() and
+            socket.sendall(ip::source(body.data(), body.size())).error) {
+            return UNANSWERED;
+        }
+
+        enum { MAX_HEAD = 65536 };
+
+        // the head is received into `content`, then erased
+        string& buffer = response.content;
+        char block[8192];
+        size_t end = string::npos;
+        while (end == string::npos) {
+            const ip::transfer tx =
+                socket.recv(ip::target(block, sizeof(block), ip::NO_FILL));
+            if (tx.error or tx.size == 0) return UNANSWERED;
+            const size_t from = buffer.size() < 3 ? 0 : buffer.size() - 3;
+            buffer.append(block, tx.size);
+            end = buffer.find("\r\n\r\n", from);
+            if (end == string::npos and buffer.size() > MAX_HEAD) {
+                return UNFORWARDABLE;
+            }
+        }
+        const size_t head_size = end + 4;
+        const substr head_text(buffer.data(), head_size);
+        if (not read_response_head(head_text, response)) return UNANSWERED;
+        const http::headers& headers = response.headers;
+        if (headers.has(TRANSFER_ENCODING)) return UNFORWARDABLE;
+        keep_alive = not has_token(headers.get(CONNECTION), "close");
+
+        const bool empty = bodiless(method, response.status);
+        const bool framed = empty or headers.has(CONTENT_LENGTH);
+        size_t length = 0;
+        if (not empty and framed and
+            not string_to(headers.get(CONTENT_LENGTH), length)) {
+            return UNFORWARDABLE;
+        }
+        if (length > max_content) return UNFORWARDABLE;
+
+        buffer.erase(0, head_size);
+        if (not framed) {
+            // the body runs until the upstream closes the connection
+            keep_alive = false;
+            for (;;) {
+                const ip::transfer tx = socket.recv(
+                    ip::target(block, sizeof(block), ip::NO_FILL));
+                if (tx.error) return UNANSWERED;
+                if (tx.size == 0) return ANSWERED;
+                if (buffer.size() + tx.size > max_content) {
+                    return UNFORWARDABLE;
+                }
+                buffer.append(block, tx.size);
+            }
+        }
+        if (buffer.size() > length) return UNANSWERED; // nothing pipelined
+        size_t received = buffer.size();
+        buffer.resize(length);
+        while (received < length) {
+            const ip::transfer tx = socket.recv(ip::target(
+                &buffer[received], length - received, ip::NO_FILL));
+            if (tx.error or tx.size == 0) return UNANSWERED;
+            received += tx.size;
+        }
+        return ANSWERED;
+    }
+
+
+    proxy::proxy(const std::vector<std::string>& names) {
+        enum { POINTS = 64 }; // per upstream, on the hash ring
+        for (size_t i = 0; i < names.size(); ++i) {
+            upstreams.emplace_back(new upstream(names[i]));
+            const uint64_t h = fnv1a(names[i]);
+            for (uint64_t point = 0; point < POINTS; ++point) {
+                ring.push_back({ mix64(h + point), i });
+            }
+        }
+        std::sort(ring.begin(), ring.end());
+    }
+
+
+    proxy::~proxy() {
+        {
+            std::lock_guard<std::mutex> lock(checker_mutex);
+            stopping = true;
+        }
+        checker_wake.notify_all();
+        if (checker.joinable()) checker.join();
+    }
+
+
+    bool
+    proxy::healthy(size_t upstream) const {
+        return upstreams[upstream]->up;
+    }
+
+
+    proxy::upstream*
+    proxy::pick(const request& request) {
+        const size_t count = upstreams.size();
+        if (count == 0) return nullptr;
+
+        // each pick starts from the next upstream, so ties are spread
+        const size_t first = turn.fetch_add(1, std::memory_order_relaxed);
+        auto nth = [&](size_t i) {
+            return upstreams[(first + i) % count].get();
+        };
+
+        upstream* chosen = nullptr;
+        switch (balance) {
+            case LEAST_OUTSTANDING:
+                for (size_t i = 0; i < count; ++i) {
+                    upstream* const u = nth(i);
+                    if (not u->up) continue;
+                    if (not chosen or u->outstanding < chosen->outstanding) {
+                        chosen = u;
+                    }
+                }
+                break;
+            case CONSISTENT_HASH: {
+                // the first upstream up, clockwise from the key's point
+                const string header = hash_key.size()
+                    ? request.headers.get(std::string_view(hash_key))
+                    : string();
+                const uint64_t point = mix64(fnv1a(
+                    hash_key.size() ? std::string_view(header)
+                                    : std::string_view(request.uri)));
+                auto itr = std::lower_bound(
+                    ring.begin(), ring.end(), std::make_pair(point, size_t(0)));
+                for (size_t i = 0; i < ring.size() and not chosen; ++i, ++itr) {
+                    if (itr == ring.end()) itr = ring.begin();
+                    upstream* const u = upstreams[itr->second].get();
+                    if (u->up) chosen = u;
+                }
+                break;
+            }
+            default:
+                for (size_t i = 0; i < count and not chosen; ++i) {
+                    if (nth(i)->up) chosen = nth(i);
+                }
+                break;
+        }
+        // with every upstream down, one is tried anyway
+        return chosen ? chosen : nth(0);
+    }
+
+
+    void
+    proxy::forward(const request& request, response& response) {
+        std::call_once(started, [this]{
+            if (health_interval_ms > 0 and upstreams.size()) {
+                checker = std::thread([this]{ check(); });
+            }
+        });
+        forwarded += 1;
+
+        string head(response.content.get_allocator());
+        write_forwarded(request, head);
+
+        upstream_answer answer = UNANSWERED;
+        if (upstream* const u = pick(request)) {
+            u->outstanding += 1;
+            // a kept-open connection may be closed by the upstream just as
+            // it is reused, so an idempotent request is retried on a new one
+            for (int attempt = 0; attempt < 2; ++attempt) {
+                bool reused = false;
+                ip::socket socket = u->checkout(timeout_ms, reused);
+                if (not socket) break;
+                bool keep_alive = false;
+                answer = exchange(
+                    socket, head, request.content, request.method,
+                    max_content, response, keep_alive);
+                if (answer == ANSWERED and keep_alive) {
+                    u->checkin(std::move(socket), max_idle);
+                }
+                if (answer != UNANSWERED) break;
+                if (not reused or not idempotent(request.method)) break;
+            }
+            // an upstream answering what cannot be forwarded is still up
+            if (answer == UNANSWERED and health_interval_ms > 0) {
+                u->up = false;
+            }
+            u->outstanding -= 1;
+        }
+        if (answer != ANSWERED) {
+            failed += 1;
+            response.reset();
+            response.status = BAD_GATEWAY;
+            return;
+        }
+
+        // the server frames the response for its own connection
+        http::headers& headers = response.headers;
+        const std::string connection(headers.get(CONNECTION));
+        std::vector<std::string> dropped;
+        for (auto& pair : headers) {
+            if (hop_by_hop(pair.first, connection)) {
+                dropped.emplace_back(pair.first);
+            }
+        }
+        for (const std::string& name : dropped) headers.erase(name);
+        headers.add("Via", "1.1 net");
+    }
+
+
+    // marks each upstream up or down by whether it answers a GET of
+    // `health_uri` with a 2XX or 3XX within the check interval
+    void
+    proxy::check() {
+        std::unique_lock<std::mutex> lock(checker_mutex);
+        while (not stopping) {
+            lock.unlock();
+            for (auto& u : upstreams) {
+                string head;
+                head.append("GET ").append(health_uri).append(" HTTP/1.1\r\n");
+                head.append("Host: ").append(u->name).append("\r\n");
+                head.append("Connection: close\r\n\r\n");
+
+                http::response response;
+                bool keep_alive = false;
+                ip::socket socket;
+                const bool answered =
+                    not socket.open(u->address.protocol) and
+                    not socket.timeout(health_interval_ms) and
+                    not socket.connect(u->address) and
+                    exchange(
+                        socket, head, {}, GET, max_content, response,
+                        keep_alive) == ANSWERED;
+                u->up = answered and response.status >= 200
+                                 and response.status < 400;
+            }
+            lock.lock();
+            checker_wake.wait_for(
+                lock, std::chrono::milliseconds(health_interval_ms),
+                [this]{ return stopping; });
+        }
+    }
+
+
+    // websocket ===============================================================
+
+
+    static
+    uint32_t
+    rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+
+    // SHA-1 of a short message, as the opening handshake requires
+    static
+    void
+    sha1(std::string_view message, uint8_t (&digest)[20]) {
+        uint32_t h[5] = {
+            0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+        };
+
+        string padded(message);
+        padded.push_back(char(0x80));
+        while (padded.size() % 64 != 56) padded.push_back('\0');
+        const uint64_t bits = uint64_t(message.size()) * 8;
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            padded.push_back(char(bits >> shift));
+        }
+
+        for (size_t block = 0; block < padded.size(); block += 64) {
+            const uint8_t* const p = (const uint8_t*)padded.data() + block;
+            uint32_t w[80];
+            for (int i = 0; i < 16; ++i) {
+                w[i] = uint32_t(p[i*4]) << 24 | uint32_t(p[i*4+1]) << 16
+                     | uint32_t(p[i*4+2]) << 8 | uint32_t(p[i*4+3]);
+            }
+            for (int i = 16; i < 80; ++i) {
+                w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+            }
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            static const uint32_t k[4] = {
+                0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+            };
+            for (int i = 0; i < 80; ++i) {
+                const int round = i / 20;
+                const uint32_t f =
+                    (round == 0) ? (b & c) | (~b & d) :
+                    (round == 2) ? (b & c) | (b & d) | (c & d) :
+                                   b ^ c ^ d;
+                const uint32_t t = rotl(a, 5) + f + e + k[round] + w[i];
+                e = d; d = c; c = rotl(b, 30); b = a; a = t;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        }
+
+        for (int i = 0; i < 20; ++i) {
+            digest[i] = uint8_t(h[i / 4] >> (24 - (i % 4) * 8));
+        }
+    }
+
+
+    static
+    string
+    base64(const uint8_t* data, size_t size) {
+        static const char digits[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        string out;
+        out.reserve((size + 2) / 3 * 4);
+        for (size_t i = 0; i < size; i += 3) {
+            const size_t   n = std::min(size - i, size_t(3));
+            const uint32_t v =
+                uint32_t(data[i]) << 16 |
+                uint32_t(n > 1 ? data[i+1] : 0) << 8 |
+                uint32_t(n > 2 ? data[i+2] : 0);
+            out.push_back(digits[v >> 18 & 63]);
+            out.push_back(digits[v >> 12 & 63]);
+            out.push_back(n > 1 ? digits[v >> 6 & 63] : '=');
+            out.push_back(n > 2 ? digits[v & 63] : '=');
+        }
+        return out;
+    }
+
+
+    string
+    websocket::accept_key(std::string_view key) {
+        string keyed(key);
+        keyed.append("258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+        uint8_t digest[20];
+        sha1(keyed, digest);
+        return base64(digest, sizeof(digest));
+    }
+
+
+    size_t
+    websocket::parse(std::string_view buffer, frame& f) {
+        const uint8_t* const p = (const uint8_t*)buffer.data();
+        if (buffer.size() < 2) return 0;
+        f.fin    = p[0] & 0x80;
+        f.rsv    = p[0] & 0x70;
+        f.type   = opcode(p[0] & 0x0F);
+        f.masked = p[1] & 0x80;
+        f.size   = p[1] & 0x7F;
+
+        size_t length = 2;
+        const size_t extended = (f.size == 126) ? 2 : (f.size == 127) ? 8 : 0;
+        if (buffer.size() < length + extended) return 0;
+        if (extended) {
+            f.size = 0;
+            for (size_t i = 0; i < extended; ++i) {
+                f.size = f.size << 8 | p[length + i];
+            }
+            length += extended;
+        }
+        if (f.masked) {
+            if (buffer.size() < length + 4) return 0;
+            memcpy(f.mask, p + length, 4);
+            length += 4;
+        }
+        return length;
+    }
+
+
+    void
+    websocket::write(
+        string&          buffer,
+        opcode           type,
+        std::string_view payload,
+        bool             fin
+    ) {
+        const uint64_t size = payload.size();
+        buffer.push_back(char((fin ? 0x80 : 0) | type));
+        if (size < 126) {
+            buffer.push_back(char(size));
+        }
+        else if (size <= 0xFFFF) {
+            buffer.push_back(char(126));
+            buffer.push_back(char(size >> 8));
+            buffer.push_back(char(size));
+        }
+        else {
+            buffer.push_back(char(127));
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                buffer.push_back(char(size >> shift));
+            }
+        }
+        buffer.append(payload);
+    }
+
+
+    void
+    websocket::unmask(char* data, size_t size, const uint8_t mask[4]) {
+        // the key repeats every four bytes, so a word of two keys lines up
+        // with every eight-byte block; compilers vectorize this loop further
+        uint64_t key;
+        memcpy(&key, mask, 4);
+        memcpy((char*)&key + 4, mask, 4);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            word ^= key;
+            memcpy(data + i, &word, 8);
+        }
+        for (; i < size; ++i) {
+            data[i] ^= char(mask[i & 3]);
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+
+
+    bool
+    websocket::ok() const {
+        lock lock(mutex);
+        return not (finished or closing);
+    }
+
+
+    size_t
+    websocket::queued() const {
+        lock lock(mutex);
+        return queue.size() - written;
+    }
+
+
+    ip::error
+    websocket::send(std::string_view payload, opcode type) {
+        lock lock(mutex);
+        if (finished or closing) return ip::error(ENOTCONN);
+        if (queue.size() - written > high_water) {
+            blocked = true;
+            return ip::error(EWOULDBLOCK);
+        }
+        return enqueue(type, payload);
+    }
+
+
+    ip::error
+    websocket::ping(std::string_view payload) {
+        if (payload.size() > 125) return ip::error(EMSGSIZE);
+        lock lock(mutex);
+        if (finished or closing) return ip::error(ENOTCONN);
+        return enqueue(PING, payload);
+    }
+
+
+    ip::error
+    websocket::close(uint16_t code, std::string_view reason) {
+        char payload[125] = { char(code >> 8), char(code) };
+        const size_t size = 2 + std::min(reason.size(), sizeof(payload) - 2);
+        memcpy(payload + 2, reason.data(), size - 2);
+        lock lock(mutex);
+        if (finished or closing) return ip::error(ENOTCONN);
+        closing = true;
+        return enqueue(CLOSE, std::string_view(payload, size));
+    }
+
+
+    // queues a frame, writing it at once if nothing is queued ahead of it
+    // and the server has started serving the connection; the caller holds
+    // `mutex`
+    ip::error
+    websocket::enqueue(opcode type, std::string_view payload) {
+        const bool idle = (written == queue.size());
+        write(queue, type, payload);
+        if (not (idle and connection)) return ip::error::none();
+        if (not flush()) return ip::error(ECONNRESET);
+        if (written < queue.size() and wakeup >= 0) {
+            // the server thread writes the rest once the socket is writable
+            const uint64_t one = 1;
+            if (::write(wakeup, &one, sizeof(one)) < 0) { /* already woken */ }
+        }
+        return ip::error::none();
+    }
+
+
+    // writes as much of the queue as the socket accepts without blocking,
+    // returning false if the connection has failed; the caller holds `mutex`
+    bool
+    websocket::flush() {
+        if (not connection) return true;
+        while (written < queue.size()) {
+            const ip::transfer tx = connection->send({
+                queue.data() + written, queue.size() - written });
+            if (tx.error) {
+                if (written > queue.size() / 2) {
+                    // drop the written prefix, so that a slow reader's
+                    // queue holds no more than twice what is unsent
+                    queue.erase(0, written);
+                    written = 0;
+                }
+                const int e = tx.error.id;
+                return e == EAGAIN or e == EWOULDBLOCK or e == EINTR;
+            }
+            written += tx.size;
+        }
+        queue.clear();
+        written = 0;
+        return true;
+    }
+
+
+    // handles every complete frame at the front of `input`, returning false
+    // once the connection should be closed
+    bool
+    websocket::receive(string& input) {
+        size_t consumed = 0;
+        auto fail = [&](uint16_t code) {
+            close(code);
+            close_code = code;
+            return false;
+        };
+
+        bool open = true;
+        while (open) {
+            const std::string_view rest =
+                std::string_view(input).substr(consumed);
+            frame f;
+            const size_t header = parse(rest, f);
+            if (header == 0) break;
+            if (f.rsv or not f.masked) { open = fail(1002); break; }
+
+            const bool control = (f.type & 0x8);
+            if (control and (not f.fin or f.size > 125)) {
+                open = fail(1002); break;
+            }
+            if (f.size > max_message or
+                message.size() + f.size > max_message) {
+                open = fail(1009); break;
+            }
+            if (rest.size() - header < f.size) break;
+
+            char* const payload = &input[consumed + header];
+            const size_t size = size_t(f.size);
+            unmask(payload, size, f.mask);
+            consumed += header + size;
+            const std::string_view data(payload, size);
+
+            switch (f.type) {
+                case TEXT:
+                case BINARY:
+                    if (message_type != CONTINUATION) {
+                        open = fail(1002); break;
+                    }
+                    if (f.fin) {
+                        if (on_message) on_message(*this, f.type, data);
+                        break;
+                    }
+                    message_type = f.type;
+                    message.assign(data);
+                    break;
+                case CONTINUATION:
+                    if (message_type == CONTINUATION) {
+                        open = fail(1002); break;
+                    }
+                    message.append(data);
+                    if (f.fin) {
+                        const opcode type = message_type;
+                        message_type = CONTINUATION;
+                        if (on_message) on_message(*this, type, message);
+                        string().swap(message);
+                    }
+                    break;
+                case PING: {
+                    // a peer that pings but does not read its pongs
+                    // violates the policy once they pass `high_water`
+                    bool flooded;
+                    {
+                        lock lock(mutex);
+                        if (closing) break;
+                        flooded = (queue.size() - written > high_water);
+                        if (not flooded) enqueue(PONG, data);
+                    }
+                    if (flooded) open = fail(1008);
+                    break;
+                }
+                case PONG:
+                    break;
+                case CLOSE: {
+                    // echo the status code, then close the connection
+                    close_code =
+                        (size >= 2)
+                        ? uint16_t(uint8_t(data[0]) << 8 | uint8_t(data[1]))
+                        : 1005;
+                    lock lock(mutex);
+                    if (not closing) {
+                        closing = true;
+                        enqueue(CLOSE, data.substr(0, 2));
+                    }
+                    open = false;
+                    break;
+                }
+                default:
+                    open = fail(1002);
+                    break;
+            }
+        }
+        input.erase(0, consumed);
+        return open;
+    }
+
+
+    // serves the connection until it closes: reads and dispatches messages,
+    // and writes what senders have queued once the socket is writable
+    void
+    websocket::run(ip::socket& socket, string& input) {
+        socket.nonblocking(true);
+        {
+            lock lock(mutex);
+            connection = &socket;
+        #if NET_PLATFORM_LINUX
+            wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        #endif
+        }
+
+        bool open = receive(input);
+        bool alive = true;
+        while (open) {
+            pollfd polls[2];
+            polls[0].fd      = socket.id;
+            polls[0].events  = POLLIN | (queued() ? POLLOUT : 0);
+            polls[0].revents = 0;
+            polls[1].fd      = wakeup;
+            polls[1].events  = POLLIN;
+            polls[1].revents = 0;
+
+            // without a wakeup, look for queued frames at least this often
+            enum { LATENCY_MS = 10 };
+            const int r = (wakeup >= 0)
+                ? poll(polls, 2, -1)
+                : poll(polls, 1, LATENCY_MS);
+            if (r < 0 and errno != EINTR) break;
+
+            if (polls[1].revents) {
+                uint64_t value;
+                if (::read(wakeup, &value, sizeof(value)) < 0) { /* empty */ }
+            }
+
+            bool drained = false;
+            {
+                lock lock(mutex);
+                if (not flush()) break;
+                if (blocked and queue.size() - written <= high_water / 2) {
+                    blocked = false;
+                    drained = true;
+                }
+            }
+            if (drained and on_drain) on_drain(*this);
+
+            if (polls[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ip::buffer block = ip::buffer::borrow();
+                if (not block) break;
+                const ip::transfer rcvd = socket.recv(block.target());
+                if (rcvd.error) {
+                    const int e = rcvd.error.id;
+                    if (e != EAGAIN and e != EWOULDBLOCK and e != EINTR) break;
+                    continue;
+                }
+                if (rcvd.size == 0) { alive = false; break; }
+                input.append(block.data, rcvd.size);
+                block = ip::buffer();
+                open = receive(input);
+            }
+        }
+
+        // write the closing frames the peer is owed, if the socket takes them
+        {
+            lock lock(mutex);
+            if (alive) flush();
+            connection = nullptr;
+            finished = true;
+            if (wakeup >= 0) ::close(wakeup);
+            wakeup = -1;
+        }
+        if (on_close) on_close(*this, close_code);
+    }
+
+
+    // channel =================================================================
+
+
+    struct channel::subscriber {
+        ip::socket         socket;
+        std::deque<event>  queue;       // published, not yet taken to send
+        std::deque<event>  sending;     // the writer's, front partly sent
+        size_t             sent    = 0; // bytes of sending.front() sent
+        size_t             queued  = 0; // bytes in both queues
+        bool               closing = false;
+        bool               failed  = false;
+
+        subscriber(ip::socket&& socket) : socket(std::move(socket)) {}
+
+        // sends as much of `sending` as one call can gather
+        ip::transfer send() const {
+        #if NET_PLATFORM_LINUX
+            enum { GATHER = 64 };
+            iovec  parts[GATHER];
+            size_t count  = 0;
+            size_t offset = sent;
+            for (auto& e : sending) {
+                if (count == GATHER) break;
+                parts[count].iov_base = (char*)e->data() + offset;
+                parts[count].iov_len  = e->size() - offset;
+                offset = 0;
+                count += 1;
+            }
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov    = parts;
+            message.msg_iovlen = count;
+            const ssize_t r = ::sendmsg(socket.id, &message, MSG_NOSIGNAL);
+            return
+                (r >= 0)
+                ? ip::transfer(size_t(r))
+                : ip::transfer(ip::error());
+        #else
+            const string& e = *sending.front();
+            return socket.send({ e.data() + sent, e.size() - sent });
+        #endif
+        }
+    };
+
+
+    channel::channel() {}
+
+
+    channel::~channel() {
+        assert(served == 0); // destroy the servers serving it first
+        {
+            lock lock(mutex);
+            stopping = true;
+        }
+        if (writer.joinable()) {
+            wake();
+            writer.join();
+        }
+        if (wakeup >= 0) ::close(wakeup);
+    }
+
+
+    size_t
+    channel::size() const {
+        lock lock(mutex);
+        return subscribers.size();
+    }
+
+
+    void
+    channel::publish(
+        std::string_view data,
+        std::string_view event,
+        std::string_view id
+    ) {
+        // event: <event>\nid: <id>\ndata: <line>\n...\n
+        // a client ends lines at "\r\n", "\r" or "\n", so each of them
+        // ends a line here too, and no text can start a field of its own
+        const auto first_line = [](std::string_view text) {
+            return text.substr(0, text.find_first_of("\r\n"));
+        };
+        event = first_line(event);
+        id    = first_line(id);
+
+        auto serialized = std::make_shared<string>();
+        string& text = *serialized;
+        text.reserve(data.size() + event.size() + id.size() + 32);
+        if (event.size()) {
+            text.append("event: ");
+            text.append(event);
+            text.push_back('\n');
+        }
+        if (id.size()) {
+            text.append("id: ");
+            text.append(id);
+            text.push_back('\n');
+        }
+        for (;;) {
+            const size_t eol = data.find_first_of("\r\n");
+            text.append("data: ");
+            text.append(data.substr(0, eol));
+            text.push_back('\n');
+            if (eol == data.npos) break;
+            const bool crlf = data.compare(eol, 2, "\r\n") == 0;
+            data.remove_prefix(eol + (crlf ? 2 : 1));
+        }
+        text.push_back('\n');
+
+        const channel::event shared = std::move(serialized);
+        const size_t size = shared->size();
+        published += 1;
+
+        bool any = false;
+        {
+            lock lock(mutex);
+            for (auto& s : subscribers) {
+                if (s->closing) continue;
+                if (s->queued + size > high_water and s->queued) {
+                    if (slow == DISCONNECT) {
+                        s->closing = true;
+                        disconnected += 1;
+                        any = true;
+                    }
+                    else {
+                        dropped += 1;
+                    }
+                    continue;
+                }
+                s->queue.push_back(shared);
+                s->queued += size;
+                any = true;
+            }
+        }
+        if (any) wake();
+    }
+
+
+    void
+    channel::disconnect() {
+        lock lock(mutex);
+        for (auto& s : subscribers) { s->closing = true; }
+        if (writer.joinable()) wake();
+    }
+
+
+    void
+    channel::subscribe(ip::socket&& socket) {
+        socket.nonblocking(true);
+        lock lock(mutex);
+        subscribers.emplace_back(new subscriber(std::move(socket)));
+        if (not writer.joinable()) {
+        #if NET_PLATFORM_LINUX
+            wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        #endif
+            writer = std::thread([this]{ write(); });
+        }
+    }
+
+
+    void
+    channel::wake() {
+        if (wakeup < 0) return;
+        const uint64_t one = 1;
+        if (::write(wakeup, &one, sizeof(one)) < 0) { /* already woken */ }
+    }
+
+
+    // sends queued events without holding `mutex`, so publishers are never
+    // held up by sockets; only this thread removes subscribers
+    void
+    channel::write() {
+        std::vector<subscriber*> active;
+        std::vector<pollfd>      polls;
+
+        for (;;) {
+            active.clear();
+            {
+                lock lock(mutex);
+                if (stopping) break;
+                // remove closed subscribers, taking the others' new events
+                size_t kept = 0;
+                for (auto& s : subscribers) {
+                    if (s->closing or s->failed) {
+                        s.reset();
+                        continue;
+                    }
+                    for (auto& e : s->queue) s->sending.push_back(std::move(e));
+                    s->queue.clear();
+                    active.push_back(s.get());
+                    subscribers[kept++] = std::move(s);
+                }
+                subscribers.resize(kept);
+            }
+
+            for (subscriber* s : active) {
+                size_t written = 0;
+                while (s->sending.size()) {
+                    const ip::transfer tx = s->send();
+                    if (tx.error) {
+                        const int err = tx.error.id;
+                        if (err != EAGAIN and err != EWOULDBLOCK) {
+                            s->failed = true;
+                        }
+                        break;
+                    }
+                    written += tx.size;
+                    s->sent += tx.size;
+                    while (s->sending.size() and
+                           s->sent >= s->sending.front()->size()) {
+                        s->sent -= s->sending.front()->size();
+                        s->sending.pop_front();
+                    }
+                }
+                if (written) {
+                    lock lock(mutex);
+                    s->queued -= written;
+                }
+            }
+
+            // wait for new events, writable sockets, or disconnections
+            polls.resize(active.size() + 1);
+            polls[0].fd      = wakeup;
+            polls[0].events  = POLLIN;
+            polls[0].revents = 0;
+            for (size_t i = 0; i < active.size(); ++i) {
+                pollfd& p = polls[i + 1];
+                p.fd      = active[i]->socket.id;
+                p.events  = POLLIN | (active[i]->sending.size() ? POLLOUT : 0);
+                p.revents = 0;
+            }
+
+            // without a wakeup, look for new events at least this often
+            enum { LATENCY_MS = 10 };
+            const int r = (wakeup >= 0)
+                ? poll(polls.data(), polls.size(), -1)
+                : poll(polls.data() + 1, polls.size() - 1, LATENCY_MS);
+            if (r < 0 and errno != EINTR) break;
+
+            if (polls[0].revents) {
+                uint64_t value;
+                if (::read(wakeup, &value, sizeof(value)) < 0) { /* empty */ }
+            }
+            for (size_t i = 0; i < active.size(); ++i) {
+                const short revents = polls[i + 1].revents;
+                if (not (revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                // subscribers only ever send their request; anything else is
+                // discarded, and end of stream means they have gone
+                char discard[512];
+                const ip::transfer rcvd =
+                    active[i]->socket.recv({ discard, ip::NO_FILL });
+                const int err = rcvd.error.id;
+                if (rcvd.error ? (err != EAGAIN and err != EWOULDBLOCK)
+                               : (rcvd.size == 0)) {
+                    active[i]->failed = true;
+                }
+            }
+        }
+
+        lock lock(mutex);
+        subscribers.clear();
+    }
+
+
+    // tunnel ==================================================================
+
+
+    namespace {
+
+    // one direction of a tunnel, moving bytes without blocking
+    struct leg {
+        enum { CHUNK = 65536 }; // a pipe's default capacity
+
+        ip::socket&            from;
+        ip::socket&            to;
+        std::atomic<uint64_t>& bytes;
+        int    pipe[2] = { -1, -1 };
+        size_t piped   = 0;     // bytes read from `from`, not yet sent
+        bool   ended   = false; // nothing more will be sent
+        bool   shut    = false; // and `to` was told so
+    #if !NET_PLATFORM_LINUX
+        std::vector<char> buffer;
+        size_t            at = 0; // of the piped bytes in `buffer`
+    #endif
+
+        leg(ip::socket& from, ip::socket& to, std::atomic<uint64_t>& bytes)
+        : from(from), to(to), bytes(bytes) {}
+
+       ~leg() {
+            if (pipe[0] >= 0) ::close(pipe[0]);
+            if (pipe[1] >= 0) ::close(pipe[1]);
+        }
+
+        bool open() {
+        #if NET_PLATFORM_LINUX
+            return pipe2(pipe, O_CLOEXEC | O_NONBLOCK) == 0;
+        #else
+            buffer.resize(CHUNK);
+            return true;
+        #endif
+        }
+
+        bool done() const { return ended and piped == 0; }
+
+        // `to` can receive no more
+        void abandon() { ended = shut = true; piped = 0; }
+
+        // moves what it can, passing on the end of `from` once sent;
+        // returns false if the tunnel failed
+        bool pump() {
+            for (int round = 0; round < 16; ++round) {
+                if (piped) {
+                    const long n = drain();
+                    if (n < 0) return ip::would_block() or errno == EINTR;
+                    piped -= size_t(n);
+                    bytes += uint64_t(n);
+                    if (piped) return true;
+                }
+                if (ended) {
+                    if (not shut) to.shutdown(ip::WRITE);
+                    shut = true;
+                    return true;
+                }
+                const long n = fill();
+                if (n < 0) return ip::would_block() or errno == EINTR;
+                if (n == 0) ended = true;
+                piped = size_t(n);
+            }
+            return true;
+        }
+
+    private:
+
+    #if NET_PLATFORM_LINUX
+        long fill() {
+            return long(splice(
+                from.id, nullptr, pipe[1], nullptr, CHUNK,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+        }
+
+        long drain() {
+            return long(splice(
+                pipe[0], nullptr, to.id, nullptr, piped,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+        }
+    #else
+        long fill() {
+            at = 0;
+            return long(::recv(from.id, buffer.data(), CHUNK, 0));
+        }
+
+        long drain() {
+            const long n = long(::send(
+                to.id, buffer.data() + at, piped, MSG_NOSIGNAL));
+            if (n > 0) at += size_t(n);
+            return n;
+        }
+    #endif
+    };
+
+    } // namespace
+
+
+    // Connects to the target, answers the client, then relays both ways.
+    // A socket reporting POLLHUP has been shut down for writing by this
+    // side and has seen the other side's FIN, or has been reset or shut
+    // down locally, so the leg towards it has nowhere to send.
+    http::status
+    tunnel::run(ip::socket& client, string& input) {
+        static const std::string_view established =
+            "HTTP/1.1 200 Connection Established\r\n\r\n";
+        static const std::string_view bad_gateway =
+            "HTTP/1.1 502 Bad Gateway\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+
+        ip::socket remote;
+        const ip::address address(ip::TCP, target.c_str());
+        const bool connected =
+            address.ok() and
+            not remote.open(address.protocol) and
+            not remote.timeout(connect_timeout_ms) and
+            not remote.connect(address);
+        if (not connected) {
+            client.sendall(ip::source(bad_gateway.data(), bad_gateway.size()));
+            return BAD_GATEWAY;
+        }
+        if (client.sendall(
+                ip::source(established.data(), established.size())).error) {
+            return OK;
+        }
+        // anything the client sent ahead of the 200
+        if (input.size()) {
+            if (remote.sendall(input).error) return OK;
+            sent += input.size();
+            string().swap(input);
+        }
+
+        client.nonblocking(true);
+        remote.nonblocking(true);
+        leg up(client, remote, sent), down(remote, client, received);
+        if (not up.open() or not down.open()) return OK;
+
+        const int timeout = (idle_timeout_ms > 0) ? idle_timeout_ms : -1;
+        for (;;) {
+            if (not up.pump() or not down.pump()) return OK;
+            if (up.done() and down.done()) return OK;
+
+            pollfd polls[2];
+            polls[0].fd = client.id;
+            polls[1].fd = remote.id;
+            polls[0].events = polls[1].events = 0;
+            polls[0].revents = polls[1].revents = 0;
+            if (not up.ended and not up.piped)     polls[0].events |= POLLIN;
+            if (up.piped)                          polls[1].events |= POLLOUT;
+            if (not down.ended and not down.piped) polls[1].events |= POLLIN;
+            if (down.piped)                        polls[0].events |= POLLOUT;
+
+            const int ready = poll(polls, 2, timeout);
+            if (ready == 0) return OK; // idle
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                return OK;
+            }
+            if (polls[0].revents & (POLLHUP | POLLERR)) down.abandon();
+            if (polls[1].revents & (POLLHUP | POLLERR)) up.abandon();
+        }
+    }
+
+
+    // codel ===================================================================
+
+
+    // The minimum wait of each interval is kept with compare-exchange, and
+    // whichever thread first sees the interval end judges it, so reports
+    // from any number of threads never take a lock.
+    bool
+    codel::admit(int64_t wait_us, int64_t now_us) {
+        unsigned bucket = 0;
+        for (int64_t w = wait_us; w > 1 and bucket < BUCKETS - 1; w >>= 1) {
+            ++bucket;
+        }
+        delays[bucket].fetch_add(1, std::memory_order_relaxed);
+
+        if (target_us <= 0) {
+            served.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        int64_t min = interval_min.load(std::memory_order_relaxed);
+        while (wait_us < min and
+               not interval_min.compare_exchange_weak(min, wait_us)) {}
+
+        int64_t end = interval_end.load();
+        if (now_us >= end and interval_end.compare_exchange_strong(
+                end, now_us + int64_t(interval_ms) * 1000)) {
+            const int64_t shortest = interval_min.exchange(INT64_MAX);
+            overload = (end != 0) and (shortest > target_us);
+        }
+
+        const int64_t limit =
+            overload ? target_us : int64_t(interval_ms) * 1000;
+        if (wait_us > limit) {
+            shed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        served.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+
+    // access_log ==============================================================
+
+
+    // One producer at a time, the thread that has set `busy`, writes at
+    // `head`; the log's writer reads at `tail`.
+    struct access_log::ring {
+        enum : uint64_t { SIZE = 1024 }; // records, a power of two
+
+        record                records[SIZE];
+        std::atomic<uint64_t> head    { 0 };
+        std::atomic<uint64_t> tail    { 0 };
+        std::atomic<bool>     busy    { false };
+        uint64_t              offered = 0; // while busy, for sampling
+    };
+
+
+    static_assert(sizeof(access_log::record) == 128, "two cache lines");
+
+
+    // enough rings for every thread running at once, however many threads
+    // there are, with room for one preempted while pushing
+    static
+    unsigned
+    access_log_rings() {
+        enum { MIN_RINGS = 8, MAX_RINGS = 64 };
+        const unsigned cpus = std::thread::hardware_concurrency();
+        return std::min<unsigned>(std::max<unsigned>(2 * cpus, MIN_RINGS),
+                                  MAX_RINGS);
+    }
+
+
+    access_log::access_log(int fd)
+    : fd(fd)
+    , count(access_log_rings())
+    , rings(new std::atomic<ring*>[access_log_rings()]) {
+        for (unsigned i = 0; i < count; ++i) rings[i] = nullptr;
+    }
+
+
+    access_log::~access_log() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (writer.joinable()) writer.join();
+        for (unsigned i = 0; i < count; ++i) delete rings[i].load();
+    }
+
+
+    void
+    access_log::push(const record& r) {
+        ring* const own = claim();
+        if (not own) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (sample > 1 and own->offered++ % sample != 0) {
+            own->busy.store(false, std::memory_order_release);
+            return;
+        }
+
+        const uint64_t head = own->head.load(std::memory_order_relaxed);
+        const uint64_t used = head - own->tail.load(std::memory_order_acquire);
+        if (used < ring::SIZE) {
+            own->records[head % ring::SIZE] = r;
+            own->head.store(head + 1, std::memory_order_release);
+        }
+        own->busy.store(false, std::memory_order_release);
+        if (used == ring::SIZE) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // a burst need not wait out the interval; the writer is woken until
+        // it has caught up
+        if (used >= ring::SIZE / 2) wake.notify_one();
+    }
+
+
+    // Starts from the calling thread's own ring, taking the lock only to add
+    // that ring on its first use, and to start the writer with the first.
+    access_log::ring*
+    access_log::claim() {
+        static std::atomic<unsigned> threads { 0 };
+        static thread_local const unsigned home = threads++;
+
+        const unsigned first = home % count;
+        if (not rings[first].load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (not rings[first].load(std::memory_order_relaxed)) {
+                rings[first].store(new ring, std::memory_order_release);
+            }
+            if (not writer.joinable()) {
+                writer = std::thread([this]{ write(); });
+            }
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            ring* const r =
+                rings[(first + i) % count].load(std::memory_order_acquire);
+            if (r and not r->busy.exchange(true, std::memory_order_acquire)) {
+                return r;
+            }
+        }
+        return nullptr;
+    }
+
+
+    // time=2026-01-02T03:04:05.678901Z peer=1.2.3.4:5 method=GET uri=/ ...
+    static
+    void
+    write_record(const access_log::record& r, std::string& out) {
+        const time_t seconds = time_t(r.time_us / 1000000);
+        tm t;
+    #if NET_COMPILER_MSVC
+        gmtime_s(&t, &seconds);
+    #else
+        gmtime_r(&seconds, &t);
+    #endif
+        const ip::address& peer = r.peer;
+        char line[256];
+        int length = snprintf(line, sizeof(line),
+            "time=%04d-%02d-%02dT%02d:%02d:%02d.%06dZ peer=%u.%u.%u.%u:%u"
+            " method=%s uri=",
+            t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+            t.tm_hour, t.tm_min, t.tm_sec, int(r.time_us % 1000000),
+            peer.a, peer.b, peer.c, peer.d, peer.port,
+            method_to_string(http::method(r.method)));
+        out.append(line, size_t(std::max(length, 0)));
+
+        // keep one field per space: escape spaces, quotes and controls
+        static const char hex[] = "0123456789ABCDEF";
+        for (size_t i = 0; i < r.uri_size; ++i) {
+            const unsigned char c = (unsigned char)r.uri[i];
+            if (c > ' ' and c < 0x7f and c != '"' and c != '\\') {
+                out += char(c);
+            }
+            else {
+                out += '%';
+                out += hex[c >> 4];
+                out += hex[c & 15];
+            }
+        }
+
+        length = snprintf(line, sizeof(line),
+            " status=%u bytes=%llu wait_us=%u service_us=%u\n",
+            unsigned(r.status), (unsigned long long)r.bytes,
+            unsigned(r.wait_us), unsigned(r.service_us));
+        out.append(line, size_t(std::max(length, 0)));
+    }
+
+
+    static
+    void
+    write_all(int fd, std::string& batch) {
+        const char* data = batch.data();
+        size_t size = batch.size();
+        while (size) {
+        #if NET_COMPILER_MSVC
+            const int n = _write(fd, data, unsigned(size));
+        #else
+            const ssize_t n = ::write(fd, data, size);
+        #endif
+            if (n < 0 and errno == EINTR) continue;
+            if (n <= 0) break; // the batch is lost, not the log
+            data += n;
+            size -= size_t(n);
+        }
+        batch.clear();
+    }
+
+
+    void
+    access_log::write() {
+        enum { BATCH = 64 * 1024 };
+        std::string batch;
+        batch.reserve(BATCH + 512);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            const bool last = stopping;
+            lock.unlock();
+
+            uint64_t written = 0;
+            for (unsigned i = 0; i < count; ++i) {
+                ring* const r = rings[i].load(std::memory_order_acquire);
+                if (not r) continue;
+                uint64_t tail = r->tail.load(std::memory_order_relaxed);
+                const uint64_t head = r->head.load(std::memory_order_acquire);
+                for (; tail != head; ++tail, ++written) {
+                    write_record(r->records[tail % ring::SIZE], batch);
+                    if (batch.size() >= BATCH) write_all(fd, batch);
+                }
+                r->tail.store(tail, std::memory_order_release);
+            }
+            if (not batch.empty()) write_all(fd, batch);
+            logged.fetch_add(written, std::memory_order_relaxed);
+
+            lock.lock();
+            if (last) break;
+            if (not stopping) {
+                wake.wait_for(lock, std::chrono::milliseconds(interval_ms));
+            }
+        }
+    }
+
+
+    // tracer ==================================================================
+
+
+    static
+    const char*
+    phase_name(tracer::phase phase) {
+        static const char* const names[] = {
+            "recv", "read", "service", "write", "send"
+        };
+        return names[phase];
+    }
+
+
+    // a small number for the calling thread, as trace viewers expect
+    static
+    uint32_t
+    thread_number() {
+        static std::atomic<uint32_t> threads { 0 };
+        static thread_local const uint32_t number = ++threads;
+        return number;
+    }
+
+
+    static
+    uint64_t
+    round_up_pow2(uint64_t n) {
+        uint64_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+
+    tracer::tracer(size_t capacity)
+    : slots(new slot[round_up_pow2(capacity)])
+    , mask(round_up_pow2(capacity) - 1) {}
+
+
+    // head sampling: each thread keeps its own count, so deciding never
+    // contends; only sampled requests draw an id
+    uint64_t
+    tracer::trace() {
+        static thread_local uint64_t offered = 0;
+        if (sample == 0 or offered++ % sample != 0) return 0;
+        return ++requests;
+    }
+
+
+    void
+    tracer::record(uint64_t request, phase phase, int64_t start, int64_t end) {
+        const uint64_t index = next.fetch_add(1, std::memory_order_relaxed);
+        slot& s = slots[index & mask];
+        const uint64_t duration =
+            uint64_t(std::min<int64_t>(std::max<int64_t>(end - start, 0),
+                                       UINT_MAX));
+
+        s.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.words[0].store(request, std::memory_order_relaxed);
+        s.words[1].store(uint64_t(start), std::memory_order_relaxed);
+        s.words[2].store(
+            duration << 32 | uint64_t(thread_number()) << 8 | phase,
+            std::memory_order_relaxed);
+        s.sequence.store(2 * index + 2, std::memory_order_release);
+    }
+
+
+    std::vector<tracer::span>
+    tracer::spans() const {
+        const uint64_t end = next.load(std::memory_order_acquire);
+        const uint64_t begin = end > mask + 1 ? end - (mask + 1) : 0;
+
+        std::vector<span> spans;
+        spans.reserve(size_t(end - begin));
+        for (uint64_t index = begin; index != end; ++index) {
+            const slot& s = slots[index & mask];
+            const uint64_t written = s.sequence.load(std::memory_order_acquire);
+            if (written != 2 * index + 2) continue; // unfinished or reused
+            const uint64_t request = s.words[0].load(std::memory_order_relaxed);
+            const uint64_t start   = s.words[1].load(std::memory_order_relaxed);
+            const uint64_t packed  = s.words[2].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.sequence.load(std::memory_order_relaxed) != written) continue;
+
+            span span;
+            span.request     = request;
+            span.start_us    = int64_t(start);
+            span.duration_us = uint32_t(packed >> 32);
+            span.thread      = uint32_t(packed >> 8) & 0xffffff;
+            span.phase       = tracer::phase(packed & 0xff);
+            spans.push_back(span);
+        }
+        return spans;
+    }
+
+
+    std::string
+    tracer::chrome_trace() const {
+        const std::vector<span> spans = this->spans();
+        std::string json;
+        json.reserve(128 + spans.size() * 112);
+        json += "{\"traceEvents\":[";
+        char event[192];
+        for (const span& s : spans) {
+            const int length = snprintf(event, sizeof(event),
+                "%s\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\","
+                "\"ts\":%lld,\"dur\":%u,\"pid\":1,\"tid\":%u,"
+                "\"args\":{\"request\":%llu}}",
+                &s == spans.data() ? "" : ",", phase_name(s.phase),
+                (long long)s.start_us, unsigned(s.duration_us),
+                unsigned(s.thread), (unsigned long long)s.request);
+            json.append(event, size_t(std::max(length, 0)));
+        }
+        json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return json;
+    }
+
+
+    // server ==================================================================
+
+
+    server::client::client(ip::socket&& s)
+    : socket(std::move(s))
+    , id(socket.id)
+    , peer(socket.peer()) {
+        //printf("client::client(%i)\n", id);
+    }
+
+
+    server::client::~client() {
+        //printf("client::~client(%i)\n", id);
+    }
+
+
+    // Clients are constructed in the slots of chunks that are only freed
+    // with the table, so later connections reuse their storage, and free
+    // slots form an index_stack, as ip::buffer's pool does.  Another thread
+    // sets a slot's BUSY bit while it uses a LIVE client's socket, and a
+    // client is only unlisted, closed and destroyed once it is not BUSY, so
+    // stop() reaches every client without a lock shared by connecting threads.
+    struct server::client_table {
+
+        enum : uint32_t { CHUNK = 256, CHUNKS = 4096 }; // up to 1M clients
+        enum : uint32_t { LIVE = 1, BUSY = 2 };
+
+        struct slot {
+            std::atomic<uint32_t> state { 0 };
+            std::atomic<uint32_t> next  { 0 }; // index + 1 below, or 0
+            alignas(client) unsigned char storage[sizeof(client)];
+
+            client& get() {
+                return *std::launder(reinterpret_cast<client*>(storage));
+            }
+        };
+
+        struct chunk { slot slots[CHUNK]; };
+
+        ip::index_stack       free;
+        std::atomic<chunk*>   chunks[CHUNKS] {};
+        std::atomic<uint32_t> chunk_count { 0 };
+        std::atomic<size_t>   live { 0 };
+        std::mutex            grow_mutex;
+
+        client_table() = default;
+
+       ~client_table() {
+            for (uint32_t i = 0; i < chunk_count.load(); ++i) {
+                delete chunks[i].load();
+            }
+        }
+
+        slot& at(uint32_t index) const {
+            chunk* const c = chunks[index / CHUNK].load(
+                std::memory_order_acquire);
+            return c->slots[index % CHUNK];
+        }
+
+        std::atomic<uint32_t>& next_of(uint32_t index) const {
+            return at(index).next;
+        }
+
+        bool pop(uint32_t& index) { return free.pop(index, *this); }
+
+        void push(uint32_t index) { free.push(index, *this); }
+
+        bool grow(uint32_t& index) {
+            lock grow_lock(grow_mutex);
+            if (pop(index)) return true; // another thread grew the table
+            const uint32_t count = chunk_count.load();
+            if (count == CHUNKS) return false;
+            chunk* const c = new(std::nothrow) chunk;
+            if (not c) return false;
+            chunks[count].store(c, std::memory_order_release);
+            chunk_count.store(count + 1, std::memory_order_release);
+            for (uint32_t i = 1; i < CHUNK; ++i) push(count * CHUNK + i);
+            index = count * CHUNK;
+            return true;
+        }
+
+        // sets BUSY on a live slot once no other thread holds it
+        static bool seize(slot& s) {
+            uint32_t state = s.state.load(std::memory_order_acquire);
+            for (;;) {
+                if (not (state & LIVE)) return false;
+                if (state & BUSY) {
+                    std::this_thread::yield();
+                    state = s.state.load(std::memory_order_acquire);
+                }
+                else if (s.state.compare_exchange_weak(
+                            state, state | BUSY,
+                            std::memory_order_acquire,
+                            std::memory_order_acquire)) {
+                    return true;
+                }
+            }
+        }
+
+        static void unseize(slot& s) {
+            s.state.fetch_and(~uint32_t(BUSY), std::memory_order_release);
+        }
+
+        // lists a client for `socket`, or returns null, leaving `socket`,
+        // if the table is full
+        client* acquire(ip::socket&& socket) {
+            uint32_t index;
+            if (not (pop(index) or grow(index))) return nullptr;
+            slot& s = at(index);
+            client* const c = new(s.storage) client(std::move(socket));
+            c->slot = index;
+            live.fetch_add(1);
+            s.state.fetch_or(LIVE, std::memory_order_release);
+            return c;
+        }
+
+        // unlists, closes and destroys `c`, once no other thread holds it
+        void release(client& c) {
+            const uint32_t index = c.slot;
+            slot& s = at(index);
+            seize(s);
+            s.state.store(0, std::memory_order_release); // not LIVE or BUSY
+            c.~client();
+            push(index);
+            live.fetch_sub(1);
+        }
+
+        // runs `f()` while holding `c`, which its own thread still lists
+        template<typename F>
+        void hold(client& c, F&& f) {
+            slot& s = at(c.slot);
+            seize(s);
+            f();
+            unseize(s);
+        }
+
+        // calls `f(client&)` for every live client, holding each meanwhile
+        template<typename F>
+        void visit(F&& f) {
+            const uint32_t count =
+                chunk_count.load(std::memory_order_acquire) * CHUNK;
+            for (uint32_t index = 0; index < count; ++index) {
+                slot& s = at(index);
+                if (seize(s)) {
+                    f(s.get());
+                    unseize(s);
+                }
+            }
+        }
+
+        bool empty() const { return live.load() == 0; }
+    };
+
+
+    //--------------------------------------------------------------------------
+
+
+    // upstream of the per-connection arenas; retains chunks between exchanges
+    struct arena_pool : std::pmr::unsynchronized_pool_resource {
+        arena_pool()
+        : unsynchronized_pool_resource(std::pmr::pool_options{ 0, 1 << 20 })
+        {}
+    };
+
+
+    // Per-client connection counts and request token buckets in a fixed table
+    // of atomics, probed linearly from a hash of the client's address, so that
+    // admitting a connection or a request never takes a lock.  An entry whose
+    // client has been idle for a minute is reused for another address; when a
+    // client finds no entry it is admitted without limits.
+    struct server::admission_table {
+
+        enum : size_t   { SLOTS = 1 << 16, PROBES = 16 }; // SLOTS: power of 2
+        enum : uint32_t { IDLE_MS = 60 * 1000 };
+
+        struct slot {
+            std::atomic<uint64_t> key         { 0 }; // 0 when unused
+            std::atomic<int>      connections { 0 };
+            std::atomic<uint64_t> bucket      { 0 }; // milli-tokens << 32 | ms
+        };                                           // 0 when full
+
+        const int      max_connections;
+        const uint64_t rate;  // milli-tokens per millisecond
+        const uint64_t burst; // milli-tokens
+        const std::chrono::steady_clock::time_point epoch;
+        std::unique_ptr<slot[]> slots;
+
+        admission_table(const http::config& config)
+        : max_connections(config.max_connections)
+        , rate (uint64_t(std::max(config.request_rate, 0)))
+        , burst(uint64_t(std::max(
+            config.request_burst ? config.request_burst : config.request_rate,
+            1)) * 1000)
+        , epoch(std::chrono::steady_clock::now())
+        , slots(new slot[SLOTS]) {}
+
+        static bool needed(const http::config& config) {
+            return config.max_connections > 0 or config.request_rate > 0;
+        }
+
+        // milliseconds since the table was made, from 1
+        uint32_t now() const {
+            using namespace std::chrono;
+            const auto elapsed = steady_clock::now() - epoch;
+            return uint32_t(duration_cast<milliseconds>(elapsed).count()) + 1;
+        }
+
+        // clients are told apart by host, not by port
+        static uint64_t key(ip::address peer) {
+            peer.port     = 0;
+            peer.protocol = ip::TCP; // keeps every key non-zero
+            return peer.bits;
+        }
+
+        static bool idle(const slot& s, uint32_t now) {
+            const uint64_t bucket = s.bucket.load(std::memory_order_relaxed);
+            return
+                s.connections.load(std::memory_order_relaxed) == 0 and
+                (bucket == 0 or now - uint32_t(bucket) > IDLE_MS);
+        }
+
+        slot* find(ip::address peer, uint32_t now) {
+            const uint64_t k = key(peer);
+            uint64_t h = k * 0x9E3779B97F4A7C15ull;
+            h ^= h >> 32;
+            for (size_t i = 0; i < PROBES; ++i) {
+                slot& s = slots[(h + i) & (SLOTS - 1)];
+                uint64_t found = s.key.load(std::memory_order_acquire);
+                if (found == k) return &s;
+                if (found == 0 or idle(s, now)) {
+                    if (s.key.compare_exchange_strong(found, k)) {
+                        s.bucket.store(0, std::memory_order_relaxed);
+                        return &s;
+                    }
+                    if (found == k) return &s;
+                }
+            }
+            return nullptr;
+        }
+
+        // counts a new connection, unless its client has too many already
+        bool connect(ip::address peer) {
+            if (max_connections <= 0) return true;
+            slot* const s = find(peer, now());
+            if (not s) return true;
+            if (s->connections.fetch_add(1) < max_connections) return true;
+            s->connections.fetch_sub(1);
+            return false;
+        }
+
+        void disconnect(ip::address peer) {
+            if (max_connections <= 0) return;
+            slot* const s = find(peer, now());
+            if (s and s->connections.load() > 0) s->connections.fetch_sub(1);
+        }
+
+        // takes a token from the client's bucket, refilled at `rate`
+        bool request(ip::address peer) {
+            if (rate == 0) return true;
+            const uint32_t t = now();
+            slot* const s = find(peer, t);
+            if (not s) return true;
+            uint64_t bucket = s->bucket.load(std::memory_order_relaxed);
+            for (;;) {
+                uint64_t tokens = burst;
+                if (bucket != 0) {
+                    const uint32_t elapsed = t - uint32_t(bucket);
+                    tokens = std::min(burst, (bucket >> 32) + elapsed * rate);
+                }
+                if (tokens < 1000) return false;
+                const uint64_t next = (tokens - 1000) << 32 | t;
+                if (s->bucket.compare_exchange_weak(bucket, next)) return true;
+            }
+        }
+    };
+
+
+    // the steady clock in microseconds, for queueing delays
+    static
+    int64_t
+    steady_us() {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(
+            steady_clock::now().time_since_epoch()).count();
+    }
+
+
+    // the record of an exchange that arrived, was started and was answered
+    // with `bytes`, at the steady microseconds given
+    static
+    access_log::record
+    exchange_record(
+        const request&  request,
+        http::status    status,
+        ip::address     peer,
+        int64_t         arrived,
+        int64_t         started,
+        uint64_t        bytes
+    ) {
+        using namespace std::chrono;
+        const int64_t now = steady_us();
+        access_log::record r;
+        r.time_us = duration_cast<microseconds>(
+            system_clock::now().time_since_epoch()).count();
+        r.peer       = peer;
+        r.wait_us    = uint32_t(std::min<int64_t>(started - arrived, UINT_MAX));
+        r.service_us = uint32_t(std::min<int64_t>(now - started, UINT_MAX));
+        r.bytes      = bytes;
+        r.status     = uint16_t(status);
+        r.method     = uint8_t(request.method);
+        const std::string_view uri(request.uri);
+        r.uri_size = uint8_t(std::min(uri.size(), sizeof(r.uri)));
+        memcpy(r.uri, uri.data(), r.uri_size);
+        return r;
+    }
+
+
+    // reports a sampled exchange's phases, in milliseconds
+    static
+    void
+    server_timing(
+        response& response, int64_t recv_us, int64_t read_us, int64_t service_us
+    ) {
+        char timing[96];
+        const int length = snprintf(timing, sizeof(timing),
+            "recv;dur=%.3f, read;dur=%.3f, service;dur=%.3f",
+            recv_us / 1000.0, read_us / 1000.0, service_us / 1000.0);
+        if (length > 0) {
+            response.headers.set("Server-Timing",
+                std::string_view(timing, size_t(length)));
+        }
+    }
+
+
+    // the answer to a request that cannot be framed, before closing
+    static
+    std::string_view
+    bad_request() {
+        return
+            "HTTP/1.1 400 Bad Request\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+    }
+
+
+    // answers refused by admission or shed, formatted once
+    static
+    const std::string&
+    unavailable(bool close) {
+        static const std::string response =
+            "HTTP/1.1 503 Service Unavailable\r\n"
+            "Retry-After: 1\r\n"
+            "Content-Length: 0\r\n"
+            "\r\n";
+        static const std::string closing =
+            "HTTP/1.1 503 Service Unavailable\r\n"
+            "Retry-After: 1\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+        return close ? closing : response;
+    }
+
+
+    // sendfile(2) and splice(2) cannot be asked not to raise SIGPIPE, so a
+    // thread sending files blocks it instead
+    static
+    void
+    quiet_sigpipe() {
+#if !NET_COMPILER_MSVC
+        static thread_local bool quiet = false;
+        if (quiet) return;
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr);
+        quiet = true;
+#endif
+    }
+
+
+    // sends `size` bytes of `file` from `offset` over a blocking socket,
+    // straight from the page cache where the platform allows
+    static
+    ip::error
+    send_file(
+        const ip::socket& socket,
+        const file&       file,
+        uint64_t          offset,
+        uint64_t          size
+    ) {
+#if NET_PLATFORM_LINUX
+        quiet_sigpipe();
+        off_t position = off_t(offset);
+        while (size) {
+            const size_t chunk = size_t(std::min<uint64_t>(size, 1u << 30));
+            const ssize_t n = sendfile(socket.id, file.fd, &position, chunk);
+            if (n < 0 and errno == EINTR) continue;
+            if (n < 0) return ip::error();
+            if (n == 0) return ip::error(EIO); // the file was truncated
+            size -= uint64_t(n);
+        }
+        return ip::error::none();
+#elif !NET_COMPILER_MSVC
+        char block[16384];
+        while (size) {
+            const size_t chunk =
+                size_t(std::min<uint64_t>(size, sizeof(block)));
+            const ssize_t n = pread(file.fd, block, chunk, off_t(offset));
+            if (n < 0 and errno == EINTR) continue;
+            if (n < 0) return ip::error();
+            if (n == 0) return ip::error(EIO);
+            const ip::transfer tx =
+                socket.sendall(ip::source(block, size_t(n)));
+            if (tx.error) return tx.error;
+            offset += uint64_t(n);
+            size   -= uint64_t(n);
+        }
+        return ip::error::none();
+#else
+        (void)socket; (void)file; (void)offset; (void)size;
+        return ip::error(ENOTSUP);
+#endif
+    }
+
+
+    void
+    server::outbox::append(
+        const response& response,
+        uint64_t        offset,
+        uint64_t        size
+    ) {
+        if (size == 0) return;
+        if (response.file) {
+            slices.push_back({ response.file, offset, size, bytes.size() });
+        }
+        else {
+            bytes.append(response.content, size_t(offset), size_t(size));
+        }
+    }
+
+
+    ip::error
+    server::outbox::send(const ip::socket& socket) const {
+        size_t at = 0;
+        for (const slice& s : slices) {
+            const ip::transfer tx =
+                socket.sendall(ip::source(bytes.data() + at, s.at - at));
+            if (tx.error) return tx.error;
+            at = s.at;
+            if (auto err = send_file(socket, *s.file, s.offset, s.size)) {
+                return err;
+            }
+        }
+        const ip::transfer tx =
+            socket.sendall(ip::source(bytes.data() + at, bytes.size() - at));
+        return tx.error;
+    }
+
+
+#if NET_URING
+
+
+    struct server::uring_loop {
+
+        enum op : uint32_t {
+            ACCEPT = 1, RECV, SEND, WAKE, CANCEL,
+            SPLICE_IN,  // from a file into the connection's pipe
+            SPLICE_OUT, // from the pipe to the connection's socket
+        };
+
+        enum : unsigned {
+            QUEUE_DEPTH  = 256,
+            BUFFER_COUNT = 1024,  // power of two
+            BUFFER_SIZE  = 4096,
+            PIPE_SIZE    = 65536, // a pipe's default capacity
+        };
+
+        struct connection {
+            const int      fd;
+            http::arena    arena;
+            http::request  request;
+            http::response response;
+            string         input;
+            outbox         output;          // being sent
+            outbox         queued;          // written while output is sent
+            size_t         sent      = 0;   // of output.bytes
+            size_t         slice     = 0;   // of output.slices being sent
+            uint64_t       spliced   = 0;   // of that slice, into the pipe
+            size_t         piped     = 0;   // in the pipe
+            int            pipe[2]   = { -1, -1 }; // once a file is sent
+            unsigned       pending   = 0;   // operations in flight
+            bool           receiving = false;
+            bool           sending   = false;
+            bool           draining  = false; // close once output is sent
+            bool           closing   = false;
+            bool           cancelling = false; // the recv, to hand off
+            takeover       taken;              // once its response is queued
+            ip::address    peer;
+
+            connection(int fd, std::pmr::memory_resource* upstream)
+            : fd(fd)
+            , arena(upstream)
+            , request(arena)
+            , response(arena) {}
+
+           ~connection() {
+                if (pipe[0] >= 0) ::close(pipe[0]);
+                if (pipe[1] >= 0) ::close(pipe[1]);
+            }
+        };
+
+        using connection_ptr = std::unique_ptr<connection>;
+
+        uring::ring                 ring;
+        uring::buffers              buffers { 0, BUFFER_SIZE };
+        arena_pool                  pool;
+        const int                   listener;
+        ip::socket                  own_listener; // unless the server's
+        admission_table* const      admission;    // or null
+        const int                   cpu;          // pinned to, or -1
+        int                         wakeup = -1;
+        uint64_t                    wakeup_value = 0;
+        bool                        multishot_accept = true;
+        bool                        multishot_recv   = true;
+        bool                        running = true;
+        bool                        accepting = true;
+        std::atomic<bool>           stopping   { false }; // once woken
+        std::atomic<bool>           quiescing  { false }; // once woken
+        std::atomic<bool>           quiesced   { false }; // no accept left
+        std::atomic<size_t>         live       { 0 };     // connections
+        std::vector<connection_ptr> connections; // indexed by fd
+        std::thread                 thread;
+
+        uring_loop(int listener, admission_table* admission, int cpu)
+        : listener(listener)
+        , admission(admission)
+        , cpu(cpu) {}
+
+       ~uring_loop() {
+            for (auto& c : connections) { if (c) ::close(c->fd); }
+            buffers.close(ring);
+            ring.close();
+            if (wakeup >= 0) ::close(wakeup);
+        }
+
+        // returns 0 on success, or an errno if io_uring is unusable
+        int open() {
+            if (const int err = ring.open(QUEUE_DEPTH)) return err;
+            if (const int err = buffers.open(ring, BUFFER_COUNT)) return err;
+            wakeup = eventfd(0, EFD_CLOEXEC);
+            if (wakeup < 0) return errno;
+            return 0;
+        }
+
+        void wake() {
+            const uint64_t one = 1;
+            if (::write(wakeup, &one, sizeof(one)) < 0) { /* already woken */ }
+        }
+
+        static uint64_t tag(op o, int fd) {
+            return (uint64_t(o) << 32) | uint32_t(fd);
+        }
+
+        // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+        void arm_accept() {
+            io_uring_sqe* const sqe = ring.get();
+            sqe->opcode    = IORING_OP_ACCEPT;
+            sqe->fd        = listener;
+            sqe->ioprio    = multishot_accept ? IORING_ACCEPT_MULTISHOT : 0;
+            sqe->user_data = tag(ACCEPT, listener);
+        }
+
+        void arm_wake() {
+            io_uring_sqe* const sqe = ring.get();
+            sqe->opcode    = IORING_OP_READ;
+            sqe->fd        = wakeup;
+            sqe->addr      = uint64_t(&wakeup_value);
+            sqe->len       = sizeof(wakeup_value);
+            sqe->user_data = tag(WAKE, wakeup);
+        }
+
+        void arm_recv(connection& c) {
+            io_uring_sqe* const sqe = ring.get();
+            sqe->opcode    = IORING_OP_RECV;
+            sqe->fd        = c.fd;
+            sqe->flags     = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = buffers.group;
+            sqe->ioprio    = multishot_recv ? IORING_RECV_MULTISHOT : 0;
+            sqe->user_data = tag(RECV, c.fd);
+            c.receiving = true;
+            c.pending += 1;
+        }
+
+        // sends the bytes ahead of the next file slice, then splices the
+        // slice through the connection's pipe, a pipe's worth at a time
+        void arm_send(connection& c) {
+            const auto& slices = c.output.slices;
+            const size_t until = (c.slice < slices.size())
+                ? slices[c.slice].at : c.output.bytes.size();
+            io_uring_sqe* const sqe = ring.get();
+            if (c.sent < until) {
+                sqe->opcode    = IORING_OP_SEND;
+                sqe->fd        = c.fd;
+                sqe->addr      = uint64_t(c.output.bytes.data() + c.sent);
+                sqe->len       = unsigned(until - c.sent);
+                sqe->msg_flags = MSG_NOSIGNAL;
+                sqe->user_data = tag(SEND, c.fd);
+            }
+            else if (c.piped) {
+                sqe->opcode        = IORING_OP_SPLICE;
+                sqe->splice_fd_in  = c.pipe[0];
+                sqe->splice_off_in = uint64_t(-1);
+                sqe->fd            = c.fd;
+                sqe->off           = uint64_t(-1);
+                sqe->len           = unsigned(c.piped);
+                sqe->user_data     = tag(SPLICE_OUT, c.fd);
+            }
+            else {
+                const outbox::slice& s = slices[c.slice];
+                if (c.pipe[0] < 0 and pipe2(c.pipe, O_CLOEXEC) != 0) {
+                    c.pipe[0] = c.pipe[1] = -1; // the splice fails, and closes
+                }
+                sqe->opcode        = IORING_OP_SPLICE;
+                sqe->splice_fd_in  = s.file->fd;
+                sqe->splice_off_in = s.offset + c.spliced;
+                sqe->fd            = c.pipe[1];
+                sqe->off           = uint64_t(-1);
+                sqe->len           = unsigned(
+                    std::min<uint64_t>(s.size - c.spliced, PIPE_SIZE));
+                sqe->user_data     = tag(SPLICE_IN, c.fd);
+            }
+            c.sending = true;
+            c.pending += 1;
+        }
+
+        // whether any output is left to send, past the slices sent
+        bool unsent(connection& c) {
+            const auto& slices = c.output.slices;
+            while (c.slice < slices.size() and c.piped == 0 and
+                   c.spliced == slices[c.slice].size) {
+                c.slice += 1;
+                c.spliced = 0;
+            }
+            return c.sent < c.output.bytes.size() or
+                   c.slice < slices.size() or c.piped;
+        }
+
+        void arm_cancel(connection& c) {
+            io_uring_sqe* const sqe = ring.get();
+            sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+            sqe->addr      = tag(RECV, c.fd);
+            sqe->user_data = tag(CANCEL, c.fd);
+            c.cancelling = true;
+        }
+
+        // stops accepting: the accept completes with -ECANCELED
+        void cancel_accept() {
+            io_uring_sqe* const sqe = ring.get();
+            sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+            sqe->addr      = tag(ACCEPT, listener);
+            sqe->user_data = tag(CANCEL, listener);
+            accepting = false;
+        }
+
+        // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+        connection& open_connection(int fd) {
+            if (size_t(fd) >= connections.size()) {
+                connections.resize(size_t(fd) + 1);
+            }
+            assert(not connections[fd]);
+            connections[fd].reset(new connection(fd, &pool));
+            live += 1;
+            return *connections[fd];
+        }
+
+        void close_connection(connection& c) {
+            if (not c.closing) {
+                c.closing = true;
+                // completes the outstanding recv/send operations
+                ::shutdown(c.fd, SHUT_RDWR);
+            }
+            if (c.pending == 0) {
+                const int fd = c.fd;
+                if (admission) admission->disconnect(c.peer);
+                ::close(fd);
+                connections[fd].reset();
+                live -= 1;
+            }
+        }
+
+        void flush(connection& c) {
+            if (c.sending or c.closing) return;
+            if (c.output.empty()) c.output.swap(c.queued);
+            if (not c.output.empty()) {
+                arm_send(c);
+            }
+            else if (c.draining) {
+                close_connection(c);
+            }
+        }
+    };
+
+
+    void
+    server::drive(uring_loop* loop_ptr) {
+        using connection = uring_loop::connection;
+
+        uring_loop& loop = *loop_ptr;
+        uring::ring& ring = loop.ring;
+
+        // receive buffers are untouched until the kernel fills them, so
+        // they can still be placed on the pinned cpu's node
+        if (loop.cpu >= 0 and ip::pin_thread(loop.cpu)) {
+            ip::bind_to_node(
+                loop.buffers.data(0),
+                size_t(uring_loop::BUFFER_COUNT) * uring_loop::BUFFER_SIZE,
+                ip::local_node());
+        }
+
+        if (const int err = ring.enable()) {
+            printf("server::drive() error: '%s'\n", strerror(err));
+            return;
+        }
+        quiet_sigpipe();
+
+        loop.arm_accept();
+        loop.arm_wake();
+
+        // when the latest batch of completions was reaped
+        int64_t arrived = steady_us();
+
+        auto on_accept = [&](const io_uring_cqe& cqe) {
+            if (cqe.res >= 0) {
+                ip::socket socket(cqe.res);
+                const ip::address peer = socket.peer();
+                if (admission and not admission->connect(peer)) {
+                    socket.send(unavailable(true)); // and close
+                }
+                else {
+                    configure(socket);
+                    connection& c = loop.open_connection(socket.release());
+                    c.peer = peer;
+                    loop.arm_recv(c);
+                }
+            }
+            else if (cqe.res == -EINVAL and loop.multishot_accept) {
+                loop.multishot_accept = false; // kernel predates 5.19
+            }
+            if (not (cqe.flags & IORING_CQE_F_MORE)) {
+                if (loop.accepting) loop.arm_accept();
+                else loop.quiesced = true;
+            }
+        };
+
+        // once its response is sent and nothing is being received, a taken
+        // over connection leaves the loop for its channel, or for a thread of
+        // its own if it is a websocket
+        auto hand_off = [&](connection& c) {
+            const bool idle =
+                not (c.receiving or c.sending or c.closing) and
+                c.output.empty() and c.queued.empty();
+            if (not idle) return;
+            const int fd = c.fd;
+            takeover taken = std::move(c.taken);
+            string input = std::move(c.input);
+            const ip::address peer = c.peer;
+            loop.connections[fd].reset(); // leaves the socket open
+            loop.live -= 1;
+
+            if (taken.channel) {
+                // subscribers no longer count against admission
+                if (admission) admission->disconnect(peer);
+                taken.channel->subscribe(ip::socket(fd));
+                return;
+            }
+
+            ip::socket socket(fd);
+            client* const owner = clients->acquire(std::move(socket));
+            if (not owner) {
+                if (admission) admission->disconnect(peer);
+                return; // the table is full; closes `socket`
+            }
+            std::thread([this,owner,taken,input]() mutable {
+                converse(*owner, std::move(taken), std::move(input));
+            }).detach();
+        };
+
+        auto on_recv = [&](connection& c, const io_uring_cqe& cqe) {
+            bool keep_alive = true;
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                const uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                if (cqe.res > 0 and not (c.closing or c.draining)) {
+                    const std::string_view received(
+                        loop.buffers.data(bid), size_t(cqe.res));
+                    outbox& output = c.sending ? c.queued : c.output;
+                    if (c.taken) {
+                        c.input.append(received); // for the websocket
+                    }
+                    else {
+                        keep_alive = respond(
+                            c.arena, c.request, c.response,
+                            c.input, received, output, c.taken, c.peer,
+                            arrived);
+                    }
+                }
+                loop.buffers.recycle(bid);
+            }
+            const bool more = cqe.flags & IORING_CQE_F_MORE;
+            if (not more) {
+                c.receiving = false;
+                c.pending -= 1;
+            }
+            if (c.closing) {
+                loop.close_connection(c);
+                return;
+            }
+            if (c.taken) {
+                // stop receiving, send the response, then hand the socket over
+                const bool ended = (cqe.res == 0) or
+                    (cqe.res < 0 and cqe.res != -ECANCELED
+                                 and cqe.res != -ENOBUFS);
+                if (ended) {
+                    loop.close_connection(c);
+                    return;
+                }
+                if (c.receiving and not c.cancelling) {
+                    loop.arm_cancel(c);
+                }
+                loop.flush(c);
+                hand_off(c);
+                return;
+            }
+            if (c.draining) {
+                return; // discard anything sent after "Connection: close"
+            }
+            if (cqe.res > 0) {
+                if (not keep_alive) {
+                    c.draining = true;
+                }
+                loop.flush(c);
+            }
+            else if (cqe.res == -EINVAL and loop.multishot_recv) {
+                loop.multishot_recv = false; // kernel predates 6.0
+            }
+            else if (cqe.res != -ENOBUFS) {
+                // disconnected or failed
+                loop.close_connection(c);
+                return;
+            }
+            if (not c.receiving) {
+                loop.arm_recv(c);
+            }
+        };
+
+        auto on_send = [&](
+            connection& c, uring_loop::op op, const io_uring_cqe& cqe
+        ) {
+            c.sending = false;
+            c.pending -= 1;
+            // a splice moving nothing met the end of a truncated file
+            const bool failed =
+                cqe.res < 0 or (cqe.res == 0 and op != uring_loop::SEND);
+            if (failed or c.closing) {
+                loop.close_connection(c);
+                return;
+            }
+            switch (op) {
+                case uring_loop::SEND:
+                    c.sent += size_t(cqe.res);
+                    break;
+                case uring_loop::SPLICE_IN:
+                    c.spliced += uint64_t(cqe.res);
+                    c.piped   += size_t(cqe.res);
+                    break;
+                default:
+                    c.piped -= size_t(cqe.res);
+                    break;
+            }
+            if (loop.unsent(c)) {
+                loop.arm_send(c);
+                return;
+            }
+            sent(c.output);
+            c.output.clear();
+            c.sent  = 0;
+            c.slice = 0;
+            loop.flush(c);
+            if (c.taken) {
+                hand_off(c);
+            }
+        };
+
+        auto on_complete = [&](const io_uring_cqe& cqe) {
+            const auto op = uring_loop::op(cqe.user_data >> 32);
+            const int  fd = int(uint32_t(cqe.user_data));
+            switch (op) {
+                case uring_loop::ACCEPT:
+                    on_accept(cqe);
+                    break;
+                case uring_loop::RECV:
+                    on_recv(*loop.connections[fd], cqe);
+                    break;
+                case uring_loop::SEND:
+                case uring_loop::SPLICE_IN:
+                case uring_loop::SPLICE_OUT:
+                    on_send(*loop.connections[fd], op, cqe);
+                    break;
+                case uring_loop::WAKE:
+                    if (loop.stopping) {
+                        loop.running = false;
+                        break;
+                    }
+                    if (loop.quiescing and loop.accepting) {
+                        loop.cancel_accept();
+                    }
+                    else if (not loop.quiescing and not loop.accepting) {
+                        loop.accepting = true;
+                        loop.arm_accept();
+                    }
+                    loop.arm_wake();
+                    break;
+                case uring_loop::CANCEL:
+                    break; // the recv completes with -ECANCELED
+            }
+        };
+
+        // while overloaded with shed_lifo, a batch is served newest first:
+        // connections in the order of their latest completion, last first,
+        // each connection's own completions still in order
+        std::vector<io_uring_cqe> batch;
+        std::vector<size_t>       latest;
+        auto newest_first = [&]() {
+            auto fd = [](const io_uring_cqe& cqe) {
+                return size_t(uint32_t(cqe.user_data));
+            };
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (fd(batch[i]) >= latest.size()) {
+                    latest.resize(fd(batch[i]) + 1);
+                }
+                latest[fd(batch[i])] = i;
+            }
+            std::stable_sort(batch.begin(), batch.end(),
+                [&](const io_uring_cqe& a, const io_uring_cqe& b) {
+                    return latest[fd(a)] > latest[fd(b)];
+                });
+        };
+
+        while (loop.running) {
+            if (const int err = ring.enter(1)) {
+                printf("server::drive() error: '%s'\n", strerror(err));
+                break;
+            }
+            arrived = steady_us();
+            if (config.shed_lifo and codel.overloaded()) {
+                batch.clear();
+                ring.reap([&](const io_uring_cqe& cqe) {
+                    batch.push_back(cqe);
+                });
+                newest_first();
+                for (const io_uring_cqe& cqe : batch) on_complete(cqe);
+            }
+            else {
+                ring.reap(on_complete);
+            }
+        }
+    }
+
+
+#endif // NET_URING
+
+
+    //--------------------------------------------------------------------------
+
+
+    uint16_t
+    server::port() const {
+        return listener.port();
+    }
+
+
+    //--------------------------------------------------------------------------
+
+
+    ip::error
+    server::start(uint16_t port, http::engine engine) {
+        http::config config = this->config;
+        config.engine = engine;
+        return start(port, config);
+    }
+
+
+    ip::error
+    server::start(uint16_t port, const http::config& config) {
+        if (listener.ok()) stop();
+
+        this->config = config;
+        const int first_cpu = config.cpus.empty() ? -1 : config.cpus[0];
+
+        if (auto err = open_listener(listener, port, first_cpu))
+            return err;
+
+        return run({});
+    }
+
+
+    ip::error
+    server::start(const ip::path& path, const http::config& config) {
+        if (listener.ok()) stop();
+
+        this->config = config;
+        int code = listener.bind(path).id;
+        if (code == EADDRINUSE and not path.abstract()) {
+            // a file left by a server that is gone refuses connections
+            ip::socket probe;
+            if (probe.connect(path).id == ECONNREFUSED) {
+                std::remove(path.name);
+                code = listener.bind(path).id;
+            }
+        }
+        if (code) {
+            listener.close();
+            return ip::error(code);
+        }
+        bound = path;
+        if (config.recv_buffer) listener.recv_buffer(config.recv_buffer);
+        if (config.send_buffer) listener.send_buffer(config.send_buffer);
+        if (auto err = listener.listen(config.backlog)) {
+            stop();
+            return err;
+        }
+        return run({});
+    }
+
+
+    ip::error
+    server::run(std::vector<ip::socket> inherited) {
+        const http::engine engine = config.engine;
+
+        clients = new client_table();
+        if (admission_table::needed(config)) {
+            admission = new admission_table(config);
+        }
+        codel.target_us   = config.shed_target_us;
+        codel.interval_ms = config.shed_interval_ms;
+
+    #if NET_URING
+        if (engine != THREADED) {
+            // a loop per cpu, each accepting from a listener of its own, and
+            // one for each further listener inherited
+            const std::vector<int>& cpus = config.cpus;
+            const size_t loops =
+                std::max(cpus.size(), inherited.size() + 1);
+            const bool local = listener.path().ok(); // one, for all loops
+            for (size_t i = 0; i < loops; ++i) {
+                const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+                ip::socket own;
+                if (i > 0 and i <= inherited.size()) {
+                    own = std::move(inherited[i - 1]);
+                }
+                else if (i > 0 and not local) {
+                    if (auto err = open_listener(own, listener.port(), cpu)) {
+                        stop();
+                        return err;
+                    }
+                }
+                const int id = own.ok() ? own.id : listener.id;
+                uring_loop* const loop = new uring_loop(id, admission, cpu);
+                loop->own_listener = std::move(own);
+                if (const int err = loop->open()) {
+                    delete loop;
+                    if (i == 0 and engine != IO_URING) break; // THREADED
+                    stop();
+                    return ip::error(err);
+                }
+                urings.push_back(loop);
+            }
+            for (uring_loop* loop : urings) {
+                loop->thread = std::thread([this,loop]{ drive(loop); });
+            }
+            if (urings.size()) return ip::error::none();
+        }
+    #else
+        if (engine == IO_URING) {
+            stop();
+            return ip::error(ENOTSUP);
+        }
+    #endif
+
+    #if !NET_COMPILER_MSVC
+        if (pipe(wakeup) != 0) {
+            const ip::error err;
+            stop();
+            return err;
+        }
+    #endif
+        // a thread accepts from `listener` alone; any other inherited
+        // listener is closed, and connections queued on it are refused
+        std::thread([this]{ listen(); }).detach();
+        return ip::error::none();
+    }
+
+
+    server::~server() {
+        stop();
+        for (auto& route : channels) { route.second->served -= 1; }
+    }
+
+
+    void
+    server::stop() {
+    #if NET_URING
+        // the loops close their own connections on the way out
+        for (uring_loop* loop : urings) {
+            loop->stopping = true;
+            loop->wake();
+            if (loop->thread.joinable()) loop->thread.join();
+            delete loop;
+        }
+        urings.clear();
+    #endif
+
+        // a listener handed over is shared with the successor, and the
+        // listen thread has left it already: it is closed, never shut down
+        if (draining) listener.close();
+
+        // closing a socket does not wake a thread blocked on it, and the listen
+        // thread may re-listen after a shutdown, so repeat until it has exited
+        stopping = true;
+        std::unique_lock<std::mutex> listen_lock(listen_mutex, std::defer_lock);
+        while (listener.shutdown(), not listen_lock.try_lock()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        listener.close();
+        stopping = false;
+
+        // a successor serves a listener handed over, under the same name
+        if (bound.ok() and not bound.abstract() and not draining) {
+            std::remove(bound.name);
+        }
+        bound = ip::path();
+        draining = false;
+    #if !NET_COMPILER_MSVC
+        for (int& fd : wakeup) {
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+        }
+    #endif
+
+        // now that listen thread has stopped,
+        // no additional clients can be added.
+
+        if (clients) {
+            // wake all client threads, which close their own sockets
+            clients->visit([](client& c) { c.socket.shutdown(); });
+
+            for (;;) {
+                // wait for all client threads to stop
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                if (clients->empty()) break;
+                //puts("server::stop() waiting for client threads...");
+            }
+        }
+
+        for (auto& route : channels) { route.second->disconnect(); }
+
+        delete admission;
+        admission = nullptr;
+        delete clients;
+        clients = nullptr;
+
+        //puts("server::stop() DONE");
+    }
+
+
+    void
+    server::upgrade(http::websocket_service websocket_service) {
+        this->websocket_service = websocket_service;
+    }
+
+
+    void
+    server::connect(http::tunnel_service tunnel_service) {
+        this->tunnel_service = tunnel_service;
+    }
+
+
+    void
+    server::events(std::string_view uri, http::channel& channel) {
+        http::channel*& route = channels[std::string(uri)];
+        if (route) route->served -= 1;
+        route = &channel;
+        channel.served += 1;
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+
+#if !NET_COMPILER_MSVC
+
+
+    // the listeners travel as one message: their count, and their file
+    // descriptors as SCM_RIGHTS
+    enum { MAX_LISTENERS = 64 };
+
+
+    static
+    bool
+    readable(int fd, int timeout_ms) {
+        pollfd p;
+        p.fd      = fd;
+        p.events  = POLLIN;
+        p.revents = 0;
+        for (;;) {
+            const int n = poll(&p, 1, timeout_ms);
+            if (n >= 0) return n > 0;
+            if (errno != EINTR) return false;
+        }
+    }
+
+
+    // returns once the successor says it accepts, since until then it may
+    // yet fail
+    static
+    ip::error
+    send_listeners(int fd, const std::vector<int>& listeners, int timeout_ms) {
+        if (listeners.size() > MAX_LISTENERS) return ip::error(E2BIG);
+        uint32_t count = uint32_t(listeners.size());
+        iovec payload;
+        payload.iov_base = &count;
+        payload.iov_len  = sizeof(count);
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov        = &payload;
+        message.msg_iovlen     = 1;
+        message.msg_control    = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+        cmsghdr* const rights = CMSG_FIRSTHDR(&message);
+        rights->cmsg_level = SOL_SOCKET;
+        rights->cmsg_type  = SCM_RIGHTS;
+        rights->cmsg_len   = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(rights), listeners.data(), sizeof(int) * count);
+
+        if (sendmsg(fd, &message, MSG_NOSIGNAL) != sizeof(count)) {
+            return ip::error();
+        }
+
+        char started = 0;
+        if (not readable(fd, timeout_ms)) return ip::error(ETIMEDOUT);
+        if (::recv(fd, &started, 1, 0) != 1 or started != 1) {
+            return ip::error(ECONNABORTED);
+        }
+        return ip::error::none();
+    }
+
+
+    // whether the process connected over the Unix socket `fd` runs as this
+    // process's user
+    static
+    bool
+    same_user(int fd) {
+    #if defined(SO_PEERCRED)
+        ucred peer;
+        socklen_t size = sizeof(peer);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) != 0) {
+            return false;
+        }
+        return peer.uid == geteuid();
+    #else
+        uid_t uid; gid_t gid;
+        if (getpeereid(fd, &uid, &gid) != 0) return false;
+        return uid == geteuid();
+    #endif
+    }
+
+
+    static
+    ip::error
+    receive_listeners(int fd, std::vector<ip::socket>& listeners) {
+        uint32_t count = 0;
+        iovec payload;
+        payload.iov_base = &count;
+        payload.iov_len  = sizeof(count);
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov        = &payload;
+        message.msg_iovlen     = 1;
+        message.msg_control    = control;
+        message.msg_controllen = sizeof(control);
+
+    #ifdef MSG_CMSG_CLOEXEC
+        const ssize_t n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    #else
+        const ssize_t n = recvmsg(fd, &message, 0);
+    #endif
+        if (n < 0) return ip::error();
+
+        // take ownership of whatever arrived before judging the message
+        for (cmsghdr* c = CMSG_FIRSTHDR(&message); c;
+             c = CMSG_NXTHDR(&message, c)) {
+            if (c->cmsg_level != SOL_SOCKET or c->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            const size_t fds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < fds; ++i) {
+                int id;
+                memcpy(&id, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                listeners.emplace_back(id);
+            }
+        }
+        const bool whole =
+            n == sizeof(count) and not (message.msg_flags & MSG_CTRUNC) and
+            listeners.size() == count and count > 0;
+        if (not whole) {
+            listeners.clear();
+            return ip::error(EPROTO);
+        }
+        return ip::error::none();
+    }
+
+
+#endif // !NET_COMPILER_MSVC
+
+
+    ip::error
+    server::hand_over(const char* path, int timeout_ms, int drain_ms) {
+    #if NET_COMPILER_MSVC
+        (void)path; (void)timeout_ms; (void)drain_ms;
+        return ip::error(ENOTSUP);
+    #else
+        if (not listener.ok()) return ip::error(ENOTCONN);
+
+        const ip::path name(path);
+        if (not name.ok()) return ip::error(ENAMETOOLONG);
+
+        // the path is the hand-over's alone: a stale one is replaced, and
+        // it is removed once the successor has connected, or given up on
+        if (not name.abstract()) std::remove(path);
+        ip::socket control;
+        if (auto err = control.listen(name, 1)) return err;
+        if (not name.abstract()) chmod(path, S_IRUSR | S_IWUSR);
+
+        // the listeners go to a process of this user only; an abstract name
+        // has no permissions, so others may connect, and are turned away
+        using namespace std::chrono;
+        const auto deadline = steady_clock::now() + milliseconds(timeout_ms);
+        ip::socket successor;
+        int refused = ETIMEDOUT;
+        for (;;) {
+            const auto left =
+                duration_cast<milliseconds>(deadline - steady_clock::now());
+            if (left.count() <= 0 or not readable(control.id, left.count())) {
+                break;
+            }
+            successor = control.accept();
+            if (not successor.ok()) { refused = errno; break; }
+            if (same_user(successor.id)) { refused = 0; break; }
+            successor.close();
+            refused = EACCES;
+        }
+        if (not name.abstract()) std::remove(path);
+        if (refused) return ip::error(refused);
+
+        // accepts stop first: a successor accepting alongside could miss
+        // connections whose wakeups went to this server's cancelled accepts
+        quiesce();
+
+        std::vector<int> listeners { listener.id };
+    #if NET_URING
+        for (uring_loop* loop : urings) {
+            if (loop->own_listener.ok()) {
+                listeners.push_back(int(loop->own_listener.id));
+            }
+        }
+    #endif
+        if (auto err = send_listeners(successor.id, listeners, timeout_ms)) {
+            resume();
+            return err;
+        }
+        draining = true;
+
+        const auto drained = steady_clock::now() + milliseconds(drain_ms);
+        for (;;) {
+            bool idle = clients->empty();
+        #if NET_URING
+            for (uring_loop* loop : urings) idle = idle and not loop->live;
+        #endif
+            if (idle or steady_clock::now() >= drained) break;
+            std::this_thread::sleep_for(milliseconds(10));
+        }
+        stop();
+        return ip::error::none();
+    #endif
+    }
+
+
+    ip::error
+    server::inherit(const char* path, const http::config& config) {
+    #if NET_COMPILER_MSVC
+        (void)path; (void)config;
+        return ip::error(ENOTSUP);
+    #else
+        if (listener.ok()) stop();
+
+        const ip::path name(path);
+        if (not name.ok()) return ip::error(ENAMETOOLONG);
+
+        ip::socket predecessor;
+        if (auto err = predecessor.connect(name)) return err;
+
+        std::vector<ip::socket> listeners;
+        if (auto err = receive_listeners(predecessor.id, listeners)) {
+            return err;
+        }
+
+        this->config = config;
+        listener = std::move(listeners.front());
+        listeners.erase(listeners.begin());
+        if (auto err = run(std::move(listeners))) return err;
+
+        const char started = 1;
+        if (::send(predecessor.id, &started, 1, MSG_NOSIGNAL) != 1) {
+            // the predecessor gave up, and serves on: both accept
+        }
+        return ip::error::none();
+    #endif
+    }
+
+
+    // Each loop cancels its accept and the listen thread is woken, and both
+    // are waited for: neither may be left accepting from listeners about to
+    // be shared with a successor.
+    void
+    server::quiesce() {
+    #if NET_URING
+        for (uring_loop* loop : urings) {
+            loop->quiescing = true;
+            loop->wake();
+        }
+        for (uring_loop* loop : urings) {
+            while (not loop->quiesced) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    #endif
+    #if !NET_COMPILER_MSVC
+        if (wakeup[1] >= 0) {
+            const char stop = 1;
+            if (::write(wakeup[1], &stop, 1) < 0) { /* already woken */ }
+            lock listen_lock(listen_mutex);
+        }
+    #endif
+    }
+
+
+    void
+    server::resume() {
+    #if NET_URING
+        for (uring_loop* loop : urings) {
+            loop->quiesced  = false;
+            loop->quiescing = false;
+            loop->wake();
+        }
+    #endif
+    #if !NET_COMPILER_MSVC
+        char stop;
+        if (wakeup[0] >= 0 and ::read(wakeup[0], &stop, 1) == 1) {
+            std::thread([this]{ listen(); }).detach();
+        }
+    #endif
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+
+    void
+    server::configure(ip::socket& connection) const {
+        if (config.nodelay)   connection.nodelay(true);
+        if (config.quickack)  connection.quickack(true);
+        if (config.busy_poll) connection.busy_poll(config.busy_poll);
+    }
+
+
+    // Opens a listener on `port`; when the engine runs a loop per cpu, the
+    // listeners share the port and each may take the connections arriving
+    // on its loop's `cpu`.
+    ip::error
+    server::open_listener(ip::socket& socket, uint16_t port, int cpu) const {
+        if (auto err = socket.open(ip::TCP))
+            return err;
 
-        ip::transfer rcvd; char block[4096];
+        const bool shared =
+            config.engine != THREADED and config.cpus.size() > 1;
+        if (shared) {
+            if (auto err = socket.reuse_port(true))
+                return err;
+        }
+
+        if (auto err = socket.bind(port))
+            return err;
+
+        // best effort: an option the platform lacks is not fatal
+        if (config.recv_buffer)  socket.recv_buffer(config.recv_buffer);
+        if (config.send_buffer)  socket.send_buffer(config.send_buffer);
+        if (config.defer_accept) socket.defer_accept(config.defer_accept);
+        if (config.fastopen)     socket.fastopen(config.fastopen);
+        if (shared and config.incoming_cpu) socket.incoming_cpu(cpu);
+
+        return socket.listen(config.backlog);
+    }
+
+
+    // the cpu to serve a connection on: the one its packets arrive on when
+    // that is one of config.cpus and config.incoming_cpu is set, otherwise
+    // the next in turn, or -1 to leave it to the scheduler
+    int
+    server::placement(const ip::socket& connection) {
+        const std::vector<int>& cpus = config.cpus;
+        if (cpus.empty()) return -1;
+        if (config.incoming_cpu) {
+            const int cpu = connection.incoming_cpu();
+            if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+                return cpu;
+            }
+        }
+        return cpus[next_cpu++ % cpus.size()];
+    }
+
+
+    // Responds to every complete request in `pending` + `received`.  Requests
+    // are parsed straight from `received` unless part of one is pending, and
+    // only an unparsed tail is kept, so a drained connection holds no input.
+    // A request's queueing delay runs from `arrived` to the start of its
+    // service, so pipelined requests also wait for those ahead of them.
+    bool
+    server::respond(
+        arena&           arena,
+        request&         request,
+        response&        response,
+        string&          pending,
+        std::string_view received,
+        outbox&          output,
+        takeover&        taken,
+        ip::address      peer,
+        int64_t          arrived
+    ) {
+        access_log* const log = config.log;
+        http::tracer* const tracer = config.tracer;
+        const bool buffered = not pending.empty();
+        if (buffered) pending.append(received);
+        std::string_view input =
+            buffered ? std::string_view(pending) : received;
+
+        bool keep_alive = true;
+        while (keep_alive and not taken) {
+            const int64_t reading = tracer ? steady_us() : 0;
+            const size_t length = request.parse(input);
+            if (length == 0) break;
+            input.remove_prefix(length);
+            if (not request.ok()) {
+                // without a body's length, nothing after it can be framed
+                output.bytes.append(bad_request());
+                input = std::string_view();
+                keep_alive = false;
+                break;
+            }
+
+            const int64_t started = steady_us();
+            const uint64_t before = log ? output.size() : 0;
+            const uint64_t traced = tracer ? tracer->trace() : 0;
+            if (traced) {
+                tracer->record(traced, tracer::RECV, arrived, reading);
+                tracer->record(traced, tracer::READ, reading, started);
+            }
+
+            bool admitted = not admission or admission->request(peer);
+            if (admitted) {
+                admitted = codel.admit(started - arrived, started);
+            }
+            if (not admitted) {
+                output.bytes.append(unavailable(false));
+                if (log) {
+                    log->push(exchange_record(
+                        request, SERVICE_UNAVAILABLE, peer,
+                        arrived, started, output.size() - before));
+                }
+                request.reset(arena);
+                arena.release();
+                continue;
+            }
 
-        while ((rcvd = socket.recv(block)) and rcvd.size) {
-            request_buffer.append(block, rcvd.size);
-            while (request.read(request_buffer)) {
+            const bool handled =
+                upgrade(request, response, output.bytes, taken) or
+                connect(request, response, taken) or
+                subscribe(request, output.bytes, taken);
+            if (not handled) {
                 service(request, response);
+            }
+            const int64_t served = traced ? steady_us() : 0;
+            if (traced) {
+                tracer->record(traced, tracer::SERVICE, started, served);
+            }
 
+            if (not taken) {
                 if (not response.ok()) {
                     response.status = NOT_IMPLEMENTED;
                 }
-                response.write(response_buffer);
-                socket.sendall(response_buffer);
-                response_buffer.clear();
-                response.reset();
+                if (draining.load(std::memory_order_relaxed)) {
+                    response.headers.set(CONNECTION, "close");
+                }
+                if (traced and tracer->server_timing) {
+                    server_timing(
+                        response, reading - arrived, started - reading,
+                        served - started);
+                }
+                char date[date_clock::SIZE];
+                reply(
+                    request, response, output,
+                    response.headers.has(DATE)
+                    ? std::string_view()
+                    : date_clock::shared().read(date));
+                if (traced) {
+                    output.traced     = traced;
+                    output.written_us = steady_us();
+                    tracer->record(
+                        traced, tracer::WRITE, served, output.written_us);
+                }
+
+                keep_alive =
+                    not has_token(request.headers.get(CONNECTION), "close") and
+                    not draining.load(std::memory_order_relaxed);
+            }
+            if (log) {
+                const http::status status =
+                    taken.websocket ? SWITCHING_PROTOCOLS
+                    : taken ? OK : response.status;
+                const access_log::record r = exchange_record(
+                    request, status, peer,
+                    arrived, started, output.size() - before);
+                if (taken.tunnel) taken.logged = r;
+                else log->push(r);
+            }
+
+            // release everything allocated by this exchange at once
+            request.reset(arena);
+            response.reset(arena);
+            arena.release();
+        }
+
+        if (input.empty()) {
+            string().swap(pending);
+        }
+        else if (buffered) {
+            pending.erase(0, pending.size() - input.size());
+        }
+        else {
+            pending.assign(input);
+        }
+        return keep_alive;
+    }
+
+
+    // ends the send span of the last sampled request in `output`
+    void
+    server::sent(const outbox& output) const {
+        if (output.traced and config.tracer) {
+            config.tracer->record(
+                output.traced, tracer::SEND, output.written_us, steady_us());
+        }
+    }
+
+
+    // If-Range holds an entity tag, which must match strongly, or a date
+    static
+    bool
+    if_range(std::string_view condition, const headers& headers) {
+        if (condition.empty()) return true;
+        if (condition.front() == '"') return condition == headers.get(ETAG);
+        if (condition.substr(0, 2) == "W/") return false;
+        return condition == headers.get(LAST_MODIFIED);
+    }
+
+
+    // "bytes 0-99/1000", or "bytes */1000" for no range
+    static
+    std::string_view
+    content_range(char (&out)[64], const byte_range* range, uint64_t size) {
+        const int length = range
+            ? snprintf(out, sizeof(out), "bytes %llu-%llu/%llu",
+                (unsigned long long)range->first,
+                (unsigned long long)range->last, (unsigned long long)size)
+            : snprintf(out, sizeof(out), "bytes */%llu",
+                (unsigned long long)size);
+        return { out, size_t(length) };
+    }
+
+
+    // separates the parts of a multipart/byteranges body; it need only be
+    // unlikely to appear in them
+    static
+    std::string_view
+    boundary(char (&out)[16]) {
+        static std::atomic<uint64_t> next { uint64_t(steady_us()) };
+        uint64_t x = mix64(next.fetch_add(0x9e3779b97f4a7c15ull));
+        static const char digits[] = "0123456789abcdef";
+        for (char& c : out) { c = digits[x & 15]; x >>= 4; }
+        return { out, sizeof(out) };
+    }
+
+
+    // A response to a GET is narrowed to the ranges asked for when it is a
+    // 200 whose length the server sets, and If-Range, if any, still holds:
+    // one range is sent as a 206 with a Content-Range, several as parts of
+    // a multipart/byteranges body, and none that is satisfiable as a 416.
+    // The ranges are appended as slices of `content` or of the file, so
+    // nothing is copied but the bytes actually sent.
+    void
+    server::reply(
+        const request&   request,
+        response&        response,
+        outbox&          output,
+        std::string_view date
+    ) {
+        http::headers& headers = response.headers;
+        const uint64_t size =
+            response.file ? response.file->size : response.content.size();
+        if (response.file) {
+            const file& file = *response.file;
+            if (not headers.has(ETAG)) headers.set(ETAG, file.etag);
+            if (not headers.has(LAST_MODIFIED)) {
+                headers.set(LAST_MODIFIED, file.last_modified);
+            }
+            if (not headers.has(ACCEPT_RANGES)) {
+                headers.set(ACCEPT_RANGES, "bytes");
+            }
+        }
+
+        const std::string_view range = request.headers.get(RANGE);
+        std::vector<byte_range> ranges;
+        const bool ranged =
+            range.size() and request.method == GET and
+            response.status == OK and
+            not headers.has(CONTENT_LENGTH) and
+            not headers.has(CONTENT_RANGE) and
+            if_range(request.headers.get(IF_RANGE), headers) and
+            parse_ranges(range, size, ranges);
+        if (not ranged) {
+            write_head(response, output.bytes, date, size);
+            output.append(response, 0, size);
+            return;
+        }
+
+        char text[64];
+        if (ranges.empty()) {
+            response.status = REQUESTED_RANGE_NOT_SATISFIABLE;
+            headers.set(CONTENT_RANGE, content_range(text, nullptr, size));
+            write_head(response, output.bytes, date, 0);
+            return;
+        }
+
+        response.status = PARTIAL_CONTENT;
+        if (ranges.size() == 1) {
+            const byte_range& r = ranges[0];
+            headers.set(CONTENT_RANGE, content_range(text, &r, size));
+            write_head(response, output.bytes, date, r.last - r.first + 1);
+            output.append(response, r.first, r.last - r.first + 1);
+            return;
+        }
+
+        // the parts' heads are written first, to know the body's length
+        char separator[16];
+        const std::string_view mark = boundary(separator);
+        const std::string type(headers.get(CONTENT_TYPE));
+        std::string heads;
+        std::vector<size_t> ends;
+        uint64_t length = 0;
+        for (const byte_range& r : ranges) {
+            heads.append("\r\n--").append(mark).append("\r\n");
+            if (type.size()) {
+                heads.append("Content-Type: ").append(type).append("\r\n");
+            }
+            heads.append("Content-Range: ");
+            heads.append(content_range(text, &r, size));
+            heads.append("\r\n\r\n");
+            ends.push_back(heads.size());
+            length += r.last - r.first + 1;
+        }
+        heads.append("\r\n--").append(mark).append("--\r\n");
+        length += heads.size();
+
+        std::string content_type = "multipart/byteranges; boundary=";
+        content_type.append(mark);
+        headers.set(CONTENT_TYPE, content_type);
+        write_head(response, output.bytes, date, length);
+        size_t at = 0;
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            output.bytes.append(heads, at, ends[i] - at);
+            at = ends[i];
+            output.append(
+                response, ranges[i].first,
+                ranges[i].last - ranges[i].first + 1);
+        }
+        output.bytes.append(heads, at, heads.size() - at);
+    }
+
+
+    // Answers a websocket upgrade request, returning false if `request` is
+    // not one.  An accepted upgrade writes the 101 response and sets
+    // `taken`; a refused or malformed one sets `response` instead.
+    bool
+    server::upgrade(
+        const request& request,
+        response&      response,
+        string&        output,
+        takeover&      taken
+    ) {
+        if (not websocket_service) return false;
+
+        const http::headers& headers = request.headers;
+        if (not has_token(headers.get(UPGRADE), "websocket")) {
+            return false;
+        }
+
+        const std::string_view key = headers.get(SEC_WEBSOCKET_KEY);
+        const bool valid =
+            request.method == GET and not key.empty() and
+            has_token(headers.get(CONNECTION), "upgrade") and
+            headers.get(SEC_WEBSOCKET_VERSION) == "13";
+        if (not valid) {
+            response.status = BAD_REQUEST;
+            response.headers.set(SEC_WEBSOCKET_VERSION, "13");
+            return true;
+        }
+
+        websocket_ptr accepted = std::make_shared<websocket>();
+        if (not websocket_service(request, accepted)) {
+            response.status = FORBIDDEN;
+            return true;
+        }
+
+        output.append(status_line(SWITCHING_PROTOCOLS));
+        output.append("Upgrade: websocket\r\n");
+        output.append("Connection: Upgrade\r\n");
+        output.append("Sec-WebSocket-Accept: ");
+        output.append(websocket::accept_key(key));
+        output.append("\r\n\r\n");
+        taken.websocket = std::move(accepted);
+        return true;
+    }
+
+
+    // Takes a CONNECT request's connection over for a tunnel, returning false
+    // if `request` is not one; a refused or malformed one sets `response`.
+    // The tunnel answers once it has reached its target.
+    bool
+    server::connect(
+        const request& request,
+        response&      response,
+        takeover&      taken
+    ) {
+        if (not tunnel_service or request.method != CONNECT) return false;
+
+        // authority-form, "host:port"
+        const std::string_view target = request.uri;
+        const size_t colon = target.rfind(':');
+        const bool valid =
+            colon != target.npos and colon > 0 and colon + 1 < target.size()
+            and target.find('/') == target.npos;
+        if (not valid) {
+            response.status = BAD_REQUEST;
+            return true;
+        }
 
-                if (request.headers.get("connection") == "close") {
-                    //printf("client(%i) requested disconnection\n", client_id);
-                    goto disconnect;
+        tunnel_ptr accepted = std::make_shared<tunnel>(std::string(target));
+        if (not tunnel_service(request, accepted)) {
+            response.status = FORBIDDEN;
+            return true;
+        }
+        taken.tunnel = std::move(accepted);
+        return true;
+    }
+
+
+    // Subscribes a GET request for a channel's uri to that channel, writing
+    // the head of an endless event stream.
+    bool
+    server::subscribe(const request& request, string& output, takeover& taken) {
+        if (request.method != GET) return false;
+        const auto itr = channels.find(std::string_view(request.uri));
+        if (itr == channels.end()) return false;
+
+        output.append(status_line(OK));
+        output.append("Content-Type: text/event-stream\r\n");
+        output.append("Cache-Control: no-cache\r\n");
+        output.append("\r\n");
+        taken.channel = itr->second;
+        return true;
+    }
+
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+
+    void
+    server::listen() {
+        lock listen_lock(listen_mutex);
+        if (config.cpus.size()) ip::pin_thread(config.cpus[0]);
+        //printf("server::listen() on port %u\n", listener.port());
+        while (not stopping and listener.ok()) {
+            if (auto err = listener.listen(config.backlog)) {
+                printf("server::listen() error: '%s'\n", err.message());
+                continue;
+            }
+            if (not accepting()) break;
+            if (ip::socket socket = listener.accept()) {
+                if (admission and not admission->connect(socket.peer())) {
+                    socket.send(unavailable(true)); // and close
+                    continue;
+                }
+                configure(socket);
+                const int cpu = placement(socket);
+                client* const c = clients->acquire(std::move(socket));
+                if (not c) {
+                    // the table is full and `socket` is still ours
+                    if (admission) admission->disconnect(socket.peer());
+                    continue; // and close
                 }
+                std::thread([this,c,cpu]{
+                    if (cpu >= 0) ip::pin_thread(cpu);
+                    serve(*c);
+                }).detach();
+            }
+        }
+        //puts("server::listen() DONE");
+    }
+
+
+    // Blocks until the listener has a connection or has been shut down, and
+    // returns false once woken to stop accepting.  Only a hand-over wakes
+    // the thread: shutting the listener down would also shut it for the
+    // successor sharing it.
+    bool
+    server::accepting() {
+    #if NET_COMPILER_MSVC
+        return true;
+    #else
+        pollfd polls[2];
+        polls[0].fd     = listener.id;
+        polls[0].events = POLLIN;
+        polls[1].fd     = wakeup[0];
+        polls[1].events = POLLIN;
+        for (;;) {
+            polls[0].revents = polls[1].revents = 0;
+            if (poll(polls, 2, -1) > 0) return polls[1].revents == 0;
+            if (errno != EINTR) return true;
+        }
+    #endif
+    }
+
+
+    // blocks until `socket` has data, or has been closed or shut down
+    static
+    bool
+    wait_readable(const ip::socket& socket) {
+        pollfd p;
+        p.fd      = socket.id;
+        p.events  = POLLIN;
+        p.revents = 0;
+        for (;;) {
+            if (poll(&p, 1, -1) > 0) return true;
+            if (errno != EINTR) return false;
+        }
+    }
+
+
+    void
+    server::serve(client& client) {
+        socket& socket = client.socket;
+
+        //const int client_id = client.id;
+        //printf("client(%i) connected on port %u\n", client_id, socket.port());
+
+        // exchanges are allocated from an arena released after each response;
+        // the pool keeps the arena's chunks for the next exchange
+        arena_pool pool;
+        arena      arena(&pool);
+
+        request  request(arena);  string request_buffer;
+        response response(arena); outbox response_buffer;
+
+        ip::transfer rcvd;
+
+        // a receive buffer is only borrowed once the connection is readable
+        while (wait_readable(socket)) {
+            ip::buffer block = ip::buffer::borrow();
+            if (not block) break;
+            rcvd = socket.recv(block.target());
+            if (not rcvd or not rcvd.size) break;
+            const std::string_view received(block.data, rcvd.size);
+            takeover taken;
+            const bool keep_alive = respond(
+                arena, request, response,
+                request_buffer, received, response_buffer,
+                taken, client.peer, steady_us());
+            block = ip::buffer();
+            if (not response_buffer.empty()) {
+                response_buffer.send(socket);
+                sent(response_buffer);
+                response_buffer.clear();
+            }
+            if (taken.websocket) {
+                taken.websocket->run(socket, request_buffer);
+                goto disconnect;
+            }
+            if (taken.tunnel) {
+                relay(taken, socket, request_buffer);
+                goto disconnect;
+            }
+            if (taken.channel) {
+                // the channel's writer serves it from now on
+                clients->hold(client, [&]{
+                    taken.channel->subscribe(std::move(socket));
+                });
+                goto disconnect;
+            }
+            if (not keep_alive) {
+                //printf("client(%i) requested disconnection\n", client_id);
+                goto disconnect;
             }
         }
 
     disconnect:
 
-        socket.close();
+        if (admission) admission->disconnect(client.peer);
 
         if (rcvd.error) {
             //printf("client(%i) error: %s\n", client_id, rcvd.error.message());
@@ -1001,10 +6764,34 @@ namespace http {
             //printf("client(%i) disconnected\n", client_id);
         }
 
-        lock clients_lock(clients_mutex);
-        clients.erase(client_ptr);
+        clients->release(client); // and close its socket
         //printf("server::serve(client(%i)) DONE\n", client_id);
     }
 
 
+    // serves a websocket or tunnel handed over by the io_uring loop
+    void
+    server::converse(
+        client&  client,
+        takeover taken,
+        string   input
+    ) {
+        if (taken.websocket) taken.websocket->run(client.socket, input);
+        if (taken.tunnel)    relay(taken, client.socket, input);
+        if (admission) admission->disconnect(client.peer);
+        clients->release(client); // and close its socket
+    }
+
+
+    // relays a tunnel, logging its exchange once it has answered
+    void
+    server::relay(takeover& taken, ip::socket& client, string& input) {
+        const http::status status = taken.tunnel->run(client, input);
+        if (config.log) {
+            taken.logged.status = uint16_t(status);
+            config.log->push(taken.logged);
+        }
+    }
+
+
 }} // namespace net::http
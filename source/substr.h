@@ -1,5 +1,7 @@
 #pragma once
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <net/assign.h>
 
 
@@ -26,7 +28,8 @@ namespace net {
         substr(const char* str)
         : substr(str, str ? strlen(str) : 0) {}
 
-        substr(const std::string& s)
+        template<typename Traits, typename Allocator>
+        substr(const std::basic_string<char, Traits, Allocator>& s)
         : substr(s.c_str(), s.length()) {}
 
     public: // operators
@@ -50,6 +53,10 @@ namespace net {
             return empty() ? std::string() : std::string(_begin, _length);
         }
 
+        operator std::string_view() const {
+            return { _begin, _length };
+        }
+
     public: // properties
         bool    empty() const { return _length == 0; }
         size_t length() const { return _length; }
@@ -0,0 +1,362 @@
+#pragma once
+#include <net/platform.h>
+
+
+#if NET_PLATFORM_LINUX && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define NET_URING 1
+    #endif
+#endif
+
+
+#if NET_URING
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace net {
+namespace uring {
+
+
+    /*==========================================================================
+    net::uring::ring
+
+    Minimal io_uring submission/completion queue pair, driven directly through
+    io_uring_setup(2)/io_uring_enter(2)/io_uring_register(2).
+
+    Submissions are only made visible to the kernel by enter(), so any number
+    of get() calls between two enter() calls are submitted as one batch.
+
+    When the kernel supports it the ring is created disabled and single-issuer,
+    so it may be opened on one thread and then enable()d by the thread that
+    will drive it.
+    --------------------------------------------------------------------------*/
+    class ring {
+
+        int fd = -1;
+
+        void*  sq_ring = nullptr;
+        size_t sq_ring_size = 0;
+        void*  cq_ring = nullptr;
+        size_t cq_ring_size = 0;
+
+        io_uring_sqe* sqes = nullptr;
+        size_t        sqes_size = 0;
+
+        unsigned* sq_head  = nullptr;
+        unsigned* sq_tail  = nullptr;
+        unsigned* sq_array = nullptr;
+        unsigned  sq_mask  = 0;
+        unsigned  sq_count = 0;
+        unsigned  sq_ready = 0;
+
+        unsigned*     cq_head = nullptr;
+        unsigned*     cq_tail = nullptr;
+        io_uring_cqe* cqes    = nullptr;
+        unsigned      cq_mask = 0;
+
+        unsigned flags = 0;
+
+        template<typename T>
+        static T* offset(void* base, unsigned bytes) {
+            return (T*)((char*)base + bytes);
+        }
+
+        static unsigned load(unsigned* p) {
+            return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+        }
+
+        static void store(unsigned* p, unsigned v) {
+            __atomic_store_n(p, v, __ATOMIC_RELEASE);
+        }
+
+    public: // structors
+
+        ring() = default;
+
+        ring(const ring&) = delete;
+        ring& operator=(const ring&) = delete;
+
+       ~ring() { close(); }
+
+    public: // properties
+
+        bool ok() const { return fd >= 0; }
+
+        int id() const { return fd; }
+
+    public: // methods
+
+        // returns 0 on success, or a positive errno
+        int open(unsigned entries) {
+            close();
+
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            params.flags = IORING_SETUP_R_DISABLED
+                         | IORING_SETUP_SINGLE_ISSUER
+                         | IORING_SETUP_DEFER_TASKRUN
+                         | IORING_SETUP_SUBMIT_ALL
+                         | IORING_SETUP_CQSIZE;
+            params.cq_entries = entries * 4;
+
+            fd = int(syscall(__NR_io_uring_setup, entries, &params));
+            if (fd < 0 and errno == EINVAL) {
+                // kernel predates SINGLE_ISSUER/DEFER_TASKRUN (6.1)
+                memset(&params, 0, sizeof(params));
+                params.flags = IORING_SETUP_CQSIZE;
+                params.cq_entries = entries * 4;
+                fd = int(syscall(__NR_io_uring_setup, entries, &params));
+            }
+            if (fd < 0) return errno;
+
+            if (not (params.features & IORING_FEAT_SINGLE_MMAP)) {
+                close();
+                return ENOTSUP;
+            }
+            flags = params.flags;
+
+            sq_ring_size =
+                params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size =
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+            sq_ring = mmap(
+                nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sq_ring == MAP_FAILED) {
+                const int err = errno;
+                sq_ring = nullptr;
+                close();
+                return err;
+            }
+            cq_ring = sq_ring;
+
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = (io_uring_sqe*)mmap(
+                nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) {
+                const int err = errno;
+                sqes = nullptr;
+                close();
+                return err;
+            }
+
+            sq_head  = offset<unsigned>(sq_ring, params.sq_off.head);
+            sq_tail  = offset<unsigned>(sq_ring, params.sq_off.tail);
+            sq_array = offset<unsigned>(sq_ring, params.sq_off.array);
+            sq_mask  = *offset<unsigned>(sq_ring, params.sq_off.ring_mask);
+            sq_count = params.sq_entries;
+            sq_ready = 0;
+
+            cq_head = offset<unsigned>(cq_ring, params.cq_off.head);
+            cq_tail = offset<unsigned>(cq_ring, params.cq_off.tail);
+            cqes    = offset<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+            cq_mask = *offset<unsigned>(cq_ring, params.cq_off.ring_mask);
+
+            return 0;
+        }
+
+        // binds the ring to the calling thread; returns 0 or an errno
+        int enable() {
+            if (not (flags & IORING_SETUP_R_DISABLED)) return 0;
+            const int r = int(syscall(
+                __NR_io_uring_register, fd, IORING_REGISTER_ENABLE_RINGS,
+                nullptr, 0));
+            return (r < 0) ? errno : 0;
+        }
+
+        void close() {
+            if (sqes) munmap(sqes, sqes_size);
+            if (sq_ring) munmap(sq_ring, sq_ring_size);
+            if (fd >= 0) ::close(fd);
+            new(this)ring();
+        }
+
+        // returns a zeroed sqe, flushing the queue to the kernel if it is full
+        io_uring_sqe* get() {
+            const unsigned tail = *sq_tail + sq_ready;
+            if (tail - load(sq_head) >= sq_count) {
+                enter(0);
+                return get();
+            }
+            const unsigned index = tail & sq_mask;
+            io_uring_sqe* const sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sq_array[index] = index;
+            sq_ready += 1;
+            return sqe;
+        }
+
+        // submits all queued sqes and waits for at least `wait` completions
+        int enter(unsigned wait) {
+            const unsigned submit = sq_ready;
+            if (submit) {
+                store(sq_tail, *sq_tail + submit);
+                sq_ready = 0;
+            }
+            const unsigned enter_flags =
+                (wait or (flags & IORING_SETUP_DEFER_TASKRUN))
+                ? IORING_ENTER_GETEVENTS : 0;
+            for (;;) {
+                const int r = int(syscall(
+                    __NR_io_uring_enter, fd, submit, wait, enter_flags,
+                    nullptr, 0));
+                if (r >= 0) return 0;
+                if (errno == EINTR) {
+                    if (submit) return 0; // submission already consumed
+                    continue;
+                }
+                if (errno == EBUSY or errno == EAGAIN) return 0;
+                return errno;
+            }
+        }
+
+        // invokes `callback(const io_uring_cqe&)` for every pending completion
+        template<typename Callback>
+        unsigned reap(Callback&& callback) {
+            unsigned head = *cq_head;
+            const unsigned tail = load(cq_tail);
+            const unsigned count = tail - head;
+            for (; head != tail; ++head) {
+                const io_uring_cqe cqe = cqes[head & cq_mask];
+                store(cq_head, head + 1);
+                callback(cqe);
+            }
+            return count;
+        }
+
+        int register_buffers(io_uring_buf_reg& reg) {
+            const int r = int(syscall(
+                __NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1));
+            return (r < 0) ? errno : 0;
+        }
+
+        int unregister_buffers(io_uring_buf_reg& reg) {
+            const int r = int(syscall(
+                __NR_io_uring_register, fd, IORING_UNREGISTER_PBUF_RING,
+                &reg, 1));
+            return (r < 0) ? errno : 0;
+        }
+    };
+
+
+    /*==========================================================================
+    net::uring::buffers
+
+    A provided-buffer ring: a group of equally sized receive buffers from
+    which the kernel picks one at completion time, so idle connections never
+    pin receive memory.  Buffers must be handed back with recycle() once the
+    received bytes have been consumed.
+    --------------------------------------------------------------------------*/
+    class buffers {
+
+        io_uring_buf_ring* bufring = nullptr;
+        char*              storage = nullptr;
+        size_t             mapping_size = 0;
+        unsigned           count = 0;
+        unsigned           mask  = 0;
+        unsigned           added = 0;
+
+    public:
+
+        const uint16_t group;
+        const unsigned size;
+
+    public: // structors
+
+        buffers(uint16_t group, unsigned size)
+        : group(group), size(size) {}
+
+        buffers(const buffers&) = delete;
+        buffers& operator=(const buffers&) = delete;
+
+       ~buffers() { assert(not bufring); }
+
+    public: // methods
+
+        // `count` must be a power of two; returns 0 on success or an errno
+        int open(ring& ring, unsigned count) {
+            const size_t ring_size = count * sizeof(io_uring_buf);
+            mapping_size = ring_size + size_t(count) * size;
+            void* const mapping = mmap(
+                nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED) return errno;
+
+            bufring = (io_uring_buf_ring*)mapping;
+            storage = (char*)mapping + ring_size;
+            this->count = count;
+            this->mask  = count - 1;
+
+            io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr    = uint64_t(bufring);
+            reg.ring_entries = count;
+            reg.bgid         = group;
+            if (const int err = ring.register_buffers(reg)) {
+                munmap(mapping, mapping_size);
+                bufring = nullptr;
+                return err;
+            }
+
+            added = 0;
+            for (unsigned bid = 0; bid < count; ++bid) {
+                provide(uint16_t(bid));
+            }
+            publish();
+            return 0;
+        }
+
+        void close(ring& ring) {
+            if (not bufring) return;
+            io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.bgid = group;
+            ring.unregister_buffers(reg);
+            munmap(bufring, mapping_size);
+            bufring = nullptr;
+            storage = nullptr;
+        }
+
+        char* data(uint16_t bid) const { return storage + size_t(bid) * size; }
+
+        void recycle(uint16_t bid) { provide(bid); publish(); }
+
+    private:
+
+        void provide(uint16_t bid) {
+            // not bufring->bufs, whose flexible array is misplaced in C++
+            io_uring_buf* const bufs = (io_uring_buf*)bufring;
+            const uint16_t tail = bufring->tail;
+            io_uring_buf& buf = bufs[(tail + added) & mask];
+            buf.addr = uint64_t(data(bid));
+            buf.len  = size;
+            buf.bid  = bid;
+            added += 1;
+        }
+
+        void publish() {
+            const uint16_t tail = uint16_t(bufring->tail + added);
+            __atomic_store_n(&bufring->tail, tail, __ATOMIC_RELEASE);
+            added = 0;
+        }
+    };
+
+
+}} // namespace net::uring
+
+
+#endif // NET_URING